@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(backlight, CONFIG_APP_LCD_LOG_LEVEL);
+
+#include <drivers/clock_control.h>
+#include <drivers/clock_control/stm32_clock_control.h>
+#include <drivers/pwm.h>
+#include <pinmux/stm32/pinmux_stm32.h>
+#include <soc.h>
+#include <stm32f4xx_ll_dma.h>
+#include <stm32f4xx_ll_tim.h>
+
+#include "backlight.h"
+#include "power.h"
+
+#ifdef CONFIG_APP_BACKLIGHT_PWM
+
+/* D10 of the lcd shield, TIM4 has to be enabled in the board overlay */
+#if defined(CONFIG_BOARD_NUCLEO_F429ZI)
+#define BACKLIGHT_PWM_DEV	"PWM_4"
+#define BACKLIGHT_PWM_CHANNEL	3		/* TIM4_CH3 PD14 */
+#define BACKLIGHT_PIN		STM32_PIN_PD14
+#define BACKLIGHT_CCR		(&TIM4->CCR3)
+#elif defined(CONFIG_BOARD_NUCLEO_F446RE)
+#define BACKLIGHT_PWM_DEV	"PWM_4"
+#define BACKLIGHT_PWM_CHANNEL	1		/* TIM4_CH1 PB6 */
+#define BACKLIGHT_PIN		STM32_PIN_PB6
+#define BACKLIGHT_CCR		(&TIM4->CCR1)
+#else
+#error "unsupported board"
+#endif
+
+#define BACKLIGHT_PINMUX	(STM32_PINMUX_ALT_FUNC_2 | STM32_PUSHPULL_NOPULL)
+
+/* TIM4 counts at 1 MHz in every clock profile, so the period and the
+ * fade ramp stay valid over a profile switch
+ */
+#define BACKLIGHT_TIMER		TIM4
+#define BACKLIGHT_PWM_HZ	1000
+#define BACKLIGHT_PERIOD	(USEC_PER_SEC / BACKLIGHT_PWM_HZ)
+
+/* The fade is a ramp of compare values in RAM, one per pwm period. The
+ * TIM4 update event requests DMA1 stream 6 to write the next one into the
+ * preloaded compare register, so nothing runs per step. Only the
+ * transfer complete interrupt ends the fade.
+ */
+#define BACKLIGHT_DMA		DMA1
+#define BACKLIGHT_DMA_STREAM	LL_DMA_STREAM_6		/* TIM4_UP */
+#define BACKLIGHT_DMA_CHANNEL	LL_DMA_CHANNEL_2
+#define BACKLIGHT_DMA_IRQ	DMA1_Stream6_IRQn
+#define BACKLIGHT_DMA_IRQ_PRIO	2
+#define BACKLIGHT_RAMP_LEN \
+	(CONFIG_APP_BACKLIGHT_FADE_MSEC * BACKLIGHT_PWM_HZ / MSEC_PER_SEC)
+
+struct backlight_ctx {
+	struct device *pwm;
+	struct device *clk;
+	struct k_spinlock lock;
+	/* fade state, protected by lock */
+	uint8_t level;		/* at rest, or where the fade started */
+	uint8_t target;
+	uint16_t steps;		/* of the running fade, 0 if none */
+	/* pwm or fade active, the timer must not stop in STOP mode */
+	bool stop_locked;
+};
+
+static struct backlight_ctx backlight_ctx;
+
+/* the last value is repeated, the compare register takes a value only
+ * with the update event after the DMA wrote it
+ */
+static uint16_t backlight_ramp[BACKLIGHT_RAMP_LEN + 1];
+
+/* The perceived brightness is roughly the square of the duty cycle */
+static inline uint16_t backlight_pulse(uint8_t percent)
+{
+	return BACKLIGHT_PERIOD * percent * percent / (100 * 100);
+}
+
+static void backlight_stop_lock(struct backlight_ctx *ctx, bool lock)
+{
+	if (lock == ctx->stop_locked) {
+		return;
+	}
+	ctx->stop_locked = lock;
+	if (lock) {
+		power_stop_lock();
+	} else {
+		power_stop_unlock();
+	}
+}
+
+/** Set the compare value at once, called with the lock held */
+static void backlight_apply(struct backlight_ctx *ctx, uint8_t percent)
+{
+	int ret;
+
+	ctx->level = percent;
+	backlight_stop_lock(ctx, (percent > 0) && (percent < 100));
+
+	ret = pwm_pin_set_cycles(ctx->pwm, BACKLIGHT_PWM_CHANNEL,
+				 BACKLIGHT_PERIOD, backlight_pulse(percent), 0);
+	if (ret) {
+		LOG_ERR("Failed to set pwm (%d)", ret);
+	}
+}
+
+static uint8_t backlight_ramp_level(struct backlight_ctx *ctx, uint16_t step)
+{
+	return ctx->level + ((int)ctx->target - ctx->level) * step / ctx->steps;
+}
+
+/** Stop a running fade where it got to, called with the lock held */
+static void backlight_fade_stop(struct backlight_ctx *ctx)
+{
+	uint16_t written;
+
+	if (!ctx->steps) {
+		return;
+	}
+
+	LL_TIM_DisableDMAReq_UPDATE(BACKLIGHT_TIMER);
+	LL_DMA_DisableStream(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM);
+	while (LL_DMA_IsEnabledStream(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM)) {
+	}
+	/* disabling the stream sets the transfer complete flag */
+	LL_DMA_ClearFlag_TC6(BACKLIGHT_DMA);
+	LL_DMA_ClearFlag_TE6(BACKLIGHT_DMA);
+
+	written = ctx->steps + 1 -
+		  LL_DMA_GetDataLength(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM);
+	ctx->level = backlight_ramp_level(ctx, MIN(written, ctx->steps));
+	ctx->steps = 0;
+}
+
+static void backlight_dma_isr(void *arg)
+{
+	struct backlight_ctx *ctx = &backlight_ctx;
+	k_spinlock_key_t key;
+
+	ARG_UNUSED(arg);
+
+	if (LL_DMA_IsActiveFlag_TE6(BACKLIGHT_DMA)) {
+		LL_DMA_ClearFlag_TE6(BACKLIGHT_DMA);
+		LOG_ERR("Fade dma error");
+	} else if (LL_DMA_IsActiveFlag_TC6(BACKLIGHT_DMA)) {
+		LL_DMA_ClearFlag_TC6(BACKLIGHT_DMA);
+	} else {
+		return;
+	}
+
+	key = k_spin_lock(&ctx->lock);
+	if (ctx->steps) {
+		LL_TIM_DisableDMAReq_UPDATE(BACKLIGHT_TIMER);
+		ctx->steps = 0;
+		/* already there after a complete transfer */
+		backlight_apply(ctx, ctx->target);
+	}
+	k_spin_unlock(&ctx->lock, key);
+}
+
+void backlight_set(void *dev, uint8_t percent, uint32_t fade_msec)
+{
+	struct backlight_ctx *ctx = dev;
+	uint16_t steps = MIN(fade_msec * BACKLIGHT_PWM_HZ / MSEC_PER_SEC,
+			     BACKLIGHT_RAMP_LEN);
+	k_spinlock_key_t key;
+
+	percent = MIN(percent, 100);
+
+	key = k_spin_lock(&ctx->lock);
+	if (percent == ctx->target) {
+		/* already there or on the way */
+		k_spin_unlock(&ctx->lock, key);
+		return;
+	}
+	backlight_fade_stop(ctx);
+	ctx->target = percent;
+	if (!steps || (percent == ctx->level)) {
+		backlight_apply(ctx, percent);
+		k_spin_unlock(&ctx->lock, key);
+		return;
+	}
+	ctx->steps = steps;
+	k_spin_unlock(&ctx->lock, key);
+
+	/* the stream is stopped and only the display thread sets the
+	 * backlight, so the ramp is filled without the lock
+	 */
+	for (uint16_t i = 0; i < steps; i++) {
+		backlight_ramp[i] = backlight_pulse(backlight_ramp_level(ctx, i + 1));
+	}
+	backlight_ramp[steps] = backlight_ramp[steps - 1];
+
+	key = k_spin_lock(&ctx->lock);
+	backlight_stop_lock(ctx, true);
+	LL_DMA_SetDataLength(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM, steps + 1);
+	LL_DMA_EnableStream(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM);
+	LL_TIM_EnableDMAReq_UPDATE(BACKLIGHT_TIMER);
+	k_spin_unlock(&ctx->lock, key);
+}
+
+/** 1 MHz count on the APB1 timer clock */
+static void backlight_timing(void)
+{
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB1,
+		.enr = LL_APB1_GRP1_PERIPH_TIM4
+	};
+	uint32_t rate;
+
+	if (clock_control_get_rate(backlight_ctx.clk,
+				   (clock_control_subsys_t *)&pclken, &rate)) {
+		return;
+	}
+
+	/* timers on a divided APB run at twice the bus clock */
+	if (LL_RCC_GetAPB1Prescaler() != LL_RCC_APB1_DIV_1) {
+		rate *= 2U;
+	}
+
+	/* preloaded, it takes effect with the next update event */
+	LL_TIM_SetPrescaler(BACKLIGHT_TIMER, rate / USEC_PER_SEC - 1);
+}
+
+static struct power_clock_listener backlight_clock_listener = {
+	.changed = backlight_timing,
+};
+
+static bool backlight_dma_init(struct backlight_ctx *ctx)
+{
+	struct stm32_pclken dma_pclken = {
+		.bus = STM32_CLOCK_BUS_AHB1,
+		.enr = LL_AHB1_GRP1_PERIPH_DMA1
+	};
+
+	if (clock_control_on(ctx->clk, (clock_control_subsys_t *)&dma_pclken)) {
+		LOG_ERR("Failed to clock fade dma");
+		return false;
+	}
+
+	LL_DMA_SetChannelSelection(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM,
+				   BACKLIGHT_DMA_CHANNEL);
+	LL_DMA_ConfigTransfer(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM,
+			      LL_DMA_DIRECTION_MEMORY_TO_PERIPH |
+			      LL_DMA_MODE_NORMAL |
+			      LL_DMA_PERIPH_NOINCREMENT |
+			      LL_DMA_MEMORY_INCREMENT |
+			      LL_DMA_PDATAALIGN_HALFWORD |
+			      LL_DMA_MDATAALIGN_HALFWORD |
+			      LL_DMA_PRIORITY_LOW);
+	LL_DMA_ConfigAddresses(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM,
+			       (uint32_t)backlight_ramp, (uint32_t)BACKLIGHT_CCR,
+			       LL_DMA_DIRECTION_MEMORY_TO_PERIPH);
+	LL_DMA_EnableIT_TC(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM);
+	LL_DMA_EnableIT_TE(BACKLIGHT_DMA, BACKLIGHT_DMA_STREAM);
+
+	IRQ_CONNECT(BACKLIGHT_DMA_IRQ, BACKLIGHT_DMA_IRQ_PRIO,
+		    backlight_dma_isr, NULL, 0);
+	irq_enable(BACKLIGHT_DMA_IRQ);
+
+	return true;
+}
+
+void *backlight_init(void)
+{
+	struct backlight_ctx *ctx = &backlight_ctx;
+	static const struct pin_config pinconf[] = {
+		{BACKLIGHT_PIN, BACKLIGHT_PINMUX},
+	};
+	k_spinlock_key_t key;
+
+	ctx->pwm = device_get_binding(BACKLIGHT_PWM_DEV);
+	if (!ctx->pwm) {
+		LOG_ERR("Cannot find %s!", BACKLIGHT_PWM_DEV);
+		return NULL;
+	}
+
+	ctx->clk = device_get_binding(STM32_CLOCK_CONTROL_NAME);
+	if (!ctx->clk || !backlight_dma_init(ctx)) {
+		return NULL;
+	}
+
+	/* the prescaler from the devicetree is replaced, the first
+	 * pwm_pin_set_cycles() loads it with an update event
+	 */
+	backlight_timing();
+	power_clock_listen(&backlight_clock_listener);
+
+	key = k_spin_lock(&ctx->lock);
+	ctx->target = 0;
+	backlight_apply(ctx, 0);
+	k_spin_unlock(&ctx->lock, key);
+
+	/* the board pinmux leaves D10 alone, switch it to the timer */
+	stm32_setup_pins(pinconf, ARRAY_SIZE(pinconf));
+
+	LOG_INF("Backlight pwm period %u us, fade ramp %u steps",
+		BACKLIGHT_PERIOD, BACKLIGHT_RAMP_LEN);
+
+	return ctx;
+}
+
+#endif /* CONFIG_APP_BACKLIGHT_PWM */
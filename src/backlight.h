@@ -0,0 +1,18 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_BACKLIGHT_H
+#define APP_BACKLIGHT_H
+
+#include <zephyr.h>
+
+/** Route the backlight pin to the timer channel, the backlight starts off */
+void *backlight_init(void);
+
+/** Change the brightness (0-100 %) linearly over fade_msec, 0 is immediate */
+void backlight_set(void *dev, uint8_t percent, uint32_t fade_msec);
+
+#endif /* APP_BACKLIGHT_H */
@@ -4,15 +4,32 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <logging/log.h>
+LOG_MODULE_REGISTER(button, CONFIG_APP_BUTTON_LOG_LEVEL);
+
 #include "buttons.h"
+#include "clock.h"
+#include "power.h"
 
 #include <zephyr.h>
 
-#include <sys/printk.h>
 #include <drivers/adc.h>
 
 #include <string.h>
 
+#if defined(CONFIG_APP_BUTTON_SAMPLING_AWD) || defined(CONFIG_APP_BUTTON_SAMPLING_DMA)
+#define BUTTON_ADC_LL
+#include <drivers/clock_control.h>
+#include <drivers/clock_control/stm32_clock_control.h>
+#include <soc.h>
+#include <stm32f4xx_ll_adc.h>
+#endif
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_DMA
+#include <stm32f4xx_ll_dma.h>
+#include <stm32f4xx_ll_tim.h>
+#endif
+
 #if defined(CONFIG_BOARD_NUCLEO_F429ZI)
 #define ADC_DEVICE_NAME         DT_LABEL(DT_INST(0, st_stm32_adc))
 #define ADC_RESOLUTION		12
@@ -20,6 +37,8 @@
 #define ADC_REFERENCE		ADC_REF_INTERNAL
 #define ADC_ACQUISITION_TIME	ADC_ACQ_TIME_DEFAULT
 #define ADC_CHANNEL_ID	3
+#define ADC_LL_CHANNEL		LL_ADC_CHANNEL_3
+#define ADC_LL_AWD_CHANNEL	LL_ADC_AWD_CHANNEL_3_REG
 #elif defined(CONFIG_BOARD_NUCLEO_F446RE)
 #define ADC_DEVICE_NAME         DT_LABEL(DT_INST(0, st_stm32_adc))
 #define ADC_RESOLUTION		12
@@ -27,10 +46,13 @@
 #define ADC_REFERENCE		ADC_REF_INTERNAL
 #define ADC_ACQUISITION_TIME	ADC_ACQ_TIME_DEFAULT
 #define ADC_CHANNEL_ID	0
+#define ADC_LL_CHANNEL		LL_ADC_CHANNEL_0
+#define ADC_LL_AWD_CHANNEL	LL_ADC_AWD_CHANNEL_0_REG
 #else
 #error "Unsupported board"
 #endif
 
+#ifdef CONFIG_APP_BUTTON_SAMPLING_POLL
 static const struct adc_channel_cfg adc_channel_cfg = {
 	.gain             = ADC_GAIN,
 	.reference        = ADC_REFERENCE,
@@ -46,7 +68,7 @@ enum adc_action adc_handler(struct device *dev,
 			    uint16_t sampling_index)
 {
 	int16_t v = m_sample_buffer[0];
-	printk("Sample %d\n", v);
+	LOG_DBG("Sample %d", v);
 	return ADC_ACTION_REPEAT;
 }
 
@@ -62,6 +84,7 @@ static const struct adc_sequence sequence = {
 	.buffer_size = sizeof(m_sample_buffer),
 	.resolution  = ADC_RESOLUTION,
 };
+#endif
 
 
 #define BUTTON_STACK_SIZE 500
@@ -69,6 +92,92 @@ static const struct adc_sequence sequence = {
 
 #define ADC_DELTA 10
 #define ADC_BUTTON_CHANGE 100
+#define ADC_MAX 4095
+
+/* The ladder levels split into bands, sorted by the lowest level of each
+ * band. Each boundary is the midpoint between two keys, so every level
+ * decodes to a key.
+ */
+#define BUTTON_BANDS 6
+/* a held key is kept until the level is this far into the next band */
+#define BUTTON_HYST 50
+/* learned levels closer than this are rejected */
+#define BUTTON_CAL_MIN_GAP (4 * BUTTON_HYST)
+#define BUTTON_CAL_MAGIC 0xAA55CA1B
+
+struct button_band {
+	uint16_t low;
+	uint8_t type;
+} __attribute__((packed));
+
+/* stored in the RTC backup registers */
+struct button_cal_store {
+	uint32_t magic;
+	struct button_band bands[BUTTON_BANDS];
+} __attribute__((packed));
+
+/* the former fixed thresholds of button_decode(); the gap it left between
+ * right (< 100) and up (> 750) is split at 425. Not measured, calibrate
+ * the keypad to replace them.
+ */
+static const struct button_band button_default_bands[BUTTON_BANDS] = {
+	{0, BUTTON_RIGHT},
+	{425, BUTTON_UP},
+	{1701, BUTTON_DOWN},
+	{2401, BUTTON_LEFT},
+	{2901, BUTTON_NONE},
+	{4081, BUTTON_SELECT},
+};
+
+static struct button_band button_bands[BUTTON_BANDS];
+
+/* the order the keys are asked for, the idle level comes first */
+static const enum button_type button_cal_order[BUTTON_BANDS] = {
+	BUTTON_NONE,
+	BUTTON_RIGHT,
+	BUTTON_UP,
+	BUTTON_DOWN,
+	BUTTON_LEFT,
+	BUTTON_SELECT,
+};
+
+struct button_cal_run {
+	volatile enum button_calibration state;
+	uint8_t step;
+	bool pressed;
+	uint16_t levels[BUTTON_BANDS];
+};
+
+static struct button_cal_run button_cal_run;
+
+static void button_awd_thresholds(void);
+
+/* thread wake-ups, to see the cost of the sampling mode */
+struct button_stats {
+	uint32_t wakeups;
+	uint32_t since_msec;
+};
+
+static struct button_stats button_stats;
+
+/* the display is lit, set by the controller */
+static volatile bool button_active = true;
+
+struct button_state {
+	void *dev;
+	button_cb *cb;
+	int prev_v;
+	int prev_stable;
+	enum button_type prev_type;
+	/* cycle counter when the current sample was taken */
+	uint32_t cycles;
+	/* auto-repeat of the held key */
+	uint8_t repeat;
+	uint32_t next_repeat;
+};
+
+/* After this many repeats the rate goes up to CONFIG_APP_BUTTON_REPEAT_FAST_MSEC */
+#define BUTTON_REPEAT_FAST_AFTER 8
 
 static int diff(int v1, int v2)
 {
@@ -79,105 +188,736 @@ static int diff(int v1, int v2)
 	return v2 - v1;
 }
 
-static bool button_decode(int16_t v, enum button_type* type)
+/** Band of a level, without hysteresis */
+static int button_band(int16_t v)
 {
-	if (v > 4080) {
-		*type = BUTTON_SELECT;
-		return true;
+	int i = BUTTON_BANDS - 1;
+
+	while ((i > 0) && (v < button_bands[i].low)) {
+		i--;
 	}
-	
-	if (v > 2900) {
-		*type = BUTTON_NONE;
-		return true;
+	return i;
+}
+
+/** Decode a level, current is kept within BUTTON_HYST of its band */
+static enum button_type button_decode(int16_t v, enum button_type current)
+{
+	const struct button_band *b = button_bands;
+	int i = button_band(v);
+
+	if ((i > 0) && (b[i - 1].type == current) &&
+	    (v < b[i].low + BUTTON_HYST)) {
+		return current;
 	}
+	if ((i < BUTTON_BANDS - 1) && (b[i + 1].type == current) &&
+	    (v >= b[i + 1].low - BUTTON_HYST)) {
+		return current;
+	}
+	return b[i].type;
+}
 
-	if (v > 2400) {
-		*type = BUTTON_LEFT;
-		return true;
+/** Check a table from the backup registers */
+static bool button_bands_valid(const struct button_band *bands)
+{
+	uint8_t seen = 0;
+
+	if (bands[0].low != 0) {
+		return false;
 	}
+	for (int i = 0; i < BUTTON_BANDS; i++) {
+		if ((i > 0) && (bands[i].low < bands[i - 1].low + BUTTON_CAL_MIN_GAP / 2)) {
+			return false;
+		}
+		if (bands[i].type > BUTTON_DOWN) {
+			return false;
+		}
+		seen |= BIT(bands[i].type);
+	}
+	/* every key exactly once */
+	return seen == (BIT(BUTTON_BANDS) - 1);
+}
 
-	if (v > 1700) {
-		*type = BUTTON_DOWN;
-		return true;
+static void button_bands_load(void)
+{
+	struct button_cal_store cal;
+
+	if (clock_rtc_reg_read(CLOCK_RTC_REG_BUTTONS, &cal, sizeof(cal)) &&
+	    (cal.magic == BUTTON_CAL_MAGIC) && button_bands_valid(cal.bands)) {
+		memcpy(button_bands, cal.bands, sizeof(button_bands));
+		LOG_INF("Using calibrated keypad levels");
+	} else {
+		memcpy(button_bands, button_default_bands, sizeof(button_bands));
 	}
+}
 
-	if (v > 750) {
-		*type = BUTTON_UP;
-		return true;
+/** Build the bands from the learned levels and store them */
+static bool button_bands_learn(const uint16_t *levels)
+{
+	struct button_cal_store cal = {
+		.magic = BUTTON_CAL_MAGIC,
+	};
+	uint16_t sorted[BUTTON_BANDS];
+
+	/* insertion sort by level */
+	for (int i = 0; i < BUTTON_BANDS; i++) {
+		int j = i;
+
+		while ((j > 0) && (sorted[j - 1] > levels[i])) {
+			sorted[j] = sorted[j - 1];
+			cal.bands[j].type = cal.bands[j - 1].type;
+			j--;
+		}
+		sorted[j] = levels[i];
+		cal.bands[j].type = button_cal_order[i];
 	}
 
+	for (int i = 1; i < BUTTON_BANDS; i++) {
+		if (sorted[i] - sorted[i - 1] < BUTTON_CAL_MIN_GAP) {
+			LOG_WRN("Keypad levels %d and %d are too close",
+				sorted[i - 1], sorted[i]);
+			return false;
+		}
+		cal.bands[i].low = (sorted[i - 1] + sorted[i] + 1) / 2;
+	}
+	cal.bands[0].low = 0;
 
-	if (v < 100) {
-		*type = BUTTON_RIGHT;
-		return true;
+	for (int i = 0; i < BUTTON_BANDS; i++) {
+		LOG_DBG("Keypad band %d from %d", cal.bands[i].type, cal.bands[i].low);
 	}
 
-	return false;
+	memcpy(button_bands, cal.bands, sizeof(button_bands));
+	return clock_rtc_reg_write(CLOCK_RTC_REG_BUTTONS, &cal, sizeof(cal));
+}
+
+/** Send repeated press events while a key is held, faster after a while
+ *
+ * Select is not repeated, its hold time is measured by the controller.
+ */
+static void button_repeat(struct button_state *s)
+{
+	uint32_t now = k_uptime_get_32();
+
+	if ((s->prev_type == BUTTON_NONE) || (s->prev_type == BUTTON_SELECT) ||
+	    ((int32_t)(now - s->next_repeat) < 0)) {
+		return;
+	}
+
+	if (s->repeat < UINT8_MAX) {
+		s->repeat++;
+	}
+	s->next_repeat = now + ((s->repeat < BUTTON_REPEAT_FAST_AFTER) ?
+				CONFIG_APP_BUTTON_REPEAT_MSEC :
+				CONFIG_APP_BUTTON_REPEAT_FAST_MSEC);
+	s->cb(s->dev, s->prev_type, BUTTON_PRESSED, s->repeat, s->cycles);
+}
+
+/** Learn the level of the next key, progress is reported as a release
+ * of BUTTON_NONE
+ */
+static void button_cal_sample(struct button_state *s, int16_t v)
+{
+	struct button_cal_run *c = &button_cal_run;
+
+	/* no key event when the calibration ends or is cancelled */
+	s->prev_type = BUTTON_NONE;
+	s->prev_stable = v;
+
+	if (c->step == 0) {
+		c->levels[0] = v;
+		c->step++;
+	} else if (!c->pressed) {
+		if (diff(v, c->levels[0]) <= ADC_BUTTON_CHANGE) {
+			return;
+		}
+		c->levels[c->step] = v;
+		c->pressed = true;
+		return;
+	} else {
+		/* wait for the release */
+		if (diff(v, c->levels[0]) > ADC_BUTTON_CHANGE) {
+			return;
+		}
+		c->pressed = false;
+		if (++c->step >= BUTTON_BANDS) {
+			c->state = button_bands_learn(c->levels) ?
+				   BUTTON_CAL_DONE : BUTTON_CAL_FAILED;
+			button_awd_thresholds();
+		}
+	}
+	s->cb(s->dev, BUTTON_NONE, BUTTON_RELEASED, 0, s->cycles);
+}
+
+/** Debounce a sample and report level changes
+ *
+ * cycles is the time the sample was taken, it is passed on with the events.
+ * Returns true if the sample is stable and no button is pressed.
+ */
+static bool button_sample(struct button_state *s, int16_t v, uint32_t cycles)
+{
+	enum button_type type;
+	bool stable = diff(v, s->prev_v) < ADC_DELTA;
+
+	s->cycles = cycles;
+
+	if (button_cal_run.state == BUTTON_CAL_RUNNING) {
+		if (stable) {
+			button_cal_sample(s, v);
+		}
+		s->prev_v = v;
+		/* keep sampling until the calibration is done */
+		return false;
+	}
+
+	if (stable) {
+		/* measurement is ok, use it */
+		if (diff(v, s->prev_stable) > ADC_BUTTON_CHANGE) {
+			LOG_DBG("ADC change from %d to %d", s->prev_stable, v);
+			type = button_decode(v, s->prev_type);
+			if (s->prev_type != type) {
+				if (type == BUTTON_NONE) {
+					s->cb(s->dev, s->prev_type, BUTTON_RELEASED, 0, s->cycles);
+				} else {
+					s->cb(s->dev, type, BUTTON_PRESSED, 0, s->cycles);
+					s->repeat = 0;
+					s->next_repeat = k_uptime_get_32() +
+						CONFIG_APP_BUTTON_REPEAT_DELAY_MSEC;
+				}
+				s->prev_type = type;
+			}
+			s->prev_stable = v;
+		}
+	}
+	s->prev_v = v;
+
+	button_repeat(s);
+
+	return stable && (s->prev_type == BUTTON_NONE) &&
+	       (button_bands[button_band(v)].type == BUTTON_NONE);
+}
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_POLL
+/** Fast while the level moves or a key is held, slow when nobody looks */
+static int32_t button_poll_period(bool idle, uint32_t *last_busy)
+{
+	uint32_t now = k_uptime_get_32();
+
+	if (!idle) {
+		*last_busy = now;
+	}
+	if ((now - *last_busy) < CONFIG_APP_BUTTON_POLL_FAST_HOLD_MSEC) {
+		return CONFIG_APP_BUTTON_POLL_FAST_MSEC;
+	}
+	if (button_active) {
+		return CONFIG_APP_BUTTON_POLL_MSEC;
+	}
+	return CONFIG_APP_BUTTON_POLL_SLOW_MSEC;
 }
 
 static void button_func(void *adc_dev, void *cb_func, void *u3)
 {
 	int ret;
-	int prev_v = 0;
-	int prev_stable = 0;
-	bool res;
-	enum button_type type;
-	enum button_type prev_type = BUTTON_NONE;
-	struct device *dev = adc_dev;
-	button_cb *cb = cb_func;
-	
+	bool idle;
+	uint32_t last_busy = 0;
+	struct button_state s = {
+		.dev = adc_dev,
+		.cb = cb_func,
+		.prev_type = BUTTON_NONE,
+	};
+
 	for(;;) {
 		
-		ret = adc_read(dev, &sequence);
+		ret = adc_read(adc_dev, &sequence);
 		
 		if (ret) {
-			printk("Failed to read from adc\n");
+			LOG_ERR("Failed to read from adc");
 			return;
 		}
 		
-		int16_t v = m_sample_buffer[0];
-		if (diff(v, prev_v) < ADC_DELTA) {
-			/* measurement is ok, use it */
-			if (diff(v, prev_stable) > ADC_BUTTON_CHANGE) {
-				printk("ADC change from %d to %d\n", prev_stable, v);
-				res = button_decode(v, &type);
-				if (prev_type != type) {
-					if (type == BUTTON_NONE) {
-						cb(dev, prev_type, BUTTON_RELEASED);
-					} else {
-						cb(dev, type, BUTTON_PRESSED);						
-					}
-					prev_type = type;
-				}
-				prev_stable = v;
-			}
+		button_stats.wakeups++;
+		idle = button_sample(&s, m_sample_buffer[0], k_cycle_get_32());
+		k_msleep(button_poll_period(idle, &last_busy));
+	}
+}
+#endif
+
+#ifdef BUTTON_ADC_LL
+#define BUTTON_ADC		ADC1
+
+/* the ladder is high impedance, 480 cycles at PCLK2 90 MHz / 8 */
+#define BUTTON_ADC_SAMPLE_USEC	40
+
+static struct device *button_clk;
+
+static const struct {
+	uint16_t cycles;
+	uint32_t smp;
+} button_adc_smp[] = {
+	{ 3, LL_ADC_SAMPLINGTIME_3CYCLES },
+	{ 15, LL_ADC_SAMPLINGTIME_15CYCLES },
+	{ 28, LL_ADC_SAMPLINGTIME_28CYCLES },
+	{ 56, LL_ADC_SAMPLINGTIME_56CYCLES },
+	{ 84, LL_ADC_SAMPLINGTIME_84CYCLES },
+	{ 112, LL_ADC_SAMPLINGTIME_112CYCLES },
+	{ 144, LL_ADC_SAMPLINGTIME_144CYCLES },
+	{ 480, LL_ADC_SAMPLINGTIME_480CYCLES },
+};
+
+/** Shortest sampling time of at least BUTTON_ADC_SAMPLE_USEC at the current PCLK2 */
+static void button_adc_timing(void)
+{
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB2,
+		.enr = LL_APB2_GRP1_PERIPH_ADC1
+	};
+	uint32_t rate;
+	uint32_t cycles;
+	int i;
+
+	if (clock_control_get_rate(button_clk, (clock_control_subsys_t *)&pclken, &rate)) {
+		return;
+	}
+
+	/* ADC clock is PCLK2 / 8 */
+	cycles = (uint64_t)rate * BUTTON_ADC_SAMPLE_USEC / (8U * USEC_PER_SEC);
+	for (i = 0; i < (ARRAY_SIZE(button_adc_smp) - 1); i++) {
+		if (button_adc_smp[i].cycles >= cycles) {
+			break;
+		}
+	}
+	LL_ADC_SetChannelSamplingTime(BUTTON_ADC, ADC_LL_CHANNEL, button_adc_smp[i].smp);
+}
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_DMA
+static void button_trig_timing(void);
+#endif
+
+static void button_clock_changed(void)
+{
+	button_adc_timing();
+#ifdef CONFIG_APP_BUTTON_SAMPLING_DMA
+	button_trig_timing();
+#endif
+}
+
+static struct power_clock_listener button_clock_listener = {
+	.changed = button_clock_changed,
+};
+
+/** Clock the ADC and set up the conversion of the keypad channel */
+static bool button_adc_setup(void)
+{
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB2,
+		.enr = LL_APB2_GRP1_PERIPH_ADC1
+	};
+
+	button_clk = device_get_binding(STM32_CLOCK_CONTROL_NAME);
+	if (!button_clk ||
+	    clock_control_on(button_clk, (clock_control_subsys_t *)&pclken)) {
+		LOG_ERR("Failed to clock adc");
+		return false;
+	}
+
+	/* slowest clock and a long sampling time, the ladder is high
+	 * impedance and the level is only needed every few ms
+	 */
+	LL_ADC_SetCommonClock(__LL_ADC_COMMON_INSTANCE(BUTTON_ADC),
+			      LL_ADC_CLOCK_SYNC_PCLK_DIV8);
+	LL_ADC_SetResolution(BUTTON_ADC, LL_ADC_RESOLUTION_12B);
+	LL_ADC_REG_SetSequencerLength(BUTTON_ADC, LL_ADC_REG_SEQ_SCAN_DISABLE);
+	LL_ADC_REG_SetSequencerRanks(BUTTON_ADC, LL_ADC_REG_RANK_1, ADC_LL_CHANNEL);
+	button_adc_timing();
+	power_clock_listen(&button_clock_listener);
+	return true;
+}
+#endif
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_AWD
+/* The ADC converts continuously, the analog watchdog interrupts as soon as
+ * the level leaves the "no button" band. Only then the thread wakes up
+ * and samples until the key is released.
+ */
+#define BUTTON_ADC_IRQ		ADC_IRQn
+#define BUTTON_ADC_IRQ_PRIO	2
+
+static K_SEM_DEFINE(button_awd_sem, 0, 1);
+
+#ifdef CONFIG_APP_PM_STOP
+/* The ADC stops with its clock in STOP mode. While the display is dark the
+ * RTC wakeup timer wakes the cpu every CONFIG_APP_BUTTON_STOP_SCAN_MSEC and
+ * starts a conversion, so the analog watchdog sees every key of the
+ * ladder. The end of conversion interrupt allows STOP again. The
+ * conversion running into STOP is dropped, the second one is clean.
+ */
+#define BUTTON_SCAN_CONVERSIONS	2
+
+/* conversions left of the running scan, only touched by the interrupts */
+static uint8_t button_scan_left;
+
+static void button_scan_handler(void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	if (!button_scan_left) {
+		power_stop_lock();
+	}
+	button_scan_left = BUTTON_SCAN_CONVERSIONS;
+	LL_ADC_ClearFlag_EOCS(BUTTON_ADC);
+	LL_ADC_EnableIT_EOCS(BUTTON_ADC);
+	LL_ADC_REG_StartConversionSWStart(BUTTON_ADC);
+}
+
+static void button_scan_eoc(void)
+{
+	if (!LL_ADC_IsEnabledIT_EOCS(BUTTON_ADC) ||
+	    !LL_ADC_IsActiveFlag_EOCS(BUTTON_ADC)) {
+		return;
+	}
+	LL_ADC_ClearFlag_EOCS(BUTTON_ADC);
+
+	if (--button_scan_left == 0) {
+		LL_ADC_DisableIT_EOCS(BUTTON_ADC);
+		power_stop_unlock();
+	}
+}
+#endif
+
+static void button_adc_isr(void *arg)
+{
+	ARG_UNUSED(arg);
+
+	/* a key raises the AWD flag with the end of its conversion */
+	if (LL_ADC_IsActiveFlag_AWD1(BUTTON_ADC)) {
+		/* stays disabled while the key is held */
+		LL_ADC_DisableIT_AWD1(BUTTON_ADC);
+		LL_ADC_ClearFlag_AWD1(BUTTON_ADC);
+		k_sem_give(&button_awd_sem);
+	}
+#ifdef CONFIG_APP_PM_STOP
+	button_scan_eoc();
+#endif
+}
+
+#ifdef CONFIG_APP_PM_STOP
+
+static void button_scan_enable(bool enable)
+{
+	if (enable) {
+		(void)clock_rtc_scan_set(CONFIG_APP_BUTTON_STOP_SCAN_MSEC,
+					 button_scan_handler, NULL);
+		power_stop_unlock();
+	} else {
+		power_stop_lock();
+		(void)clock_rtc_scan_set(0, NULL, NULL);
+	}
+}
+#endif
+
+/** Sleep until the level leaves the "no button" band */
+static void button_awd_wait(void)
+{
+#ifdef CONFIG_APP_PM_STOP
+	bool wake = !button_active;
+#endif
+
+	k_sem_reset(&button_awd_sem);
+	LL_ADC_ClearFlag_AWD1(BUTTON_ADC);
+	LL_ADC_EnableIT_AWD1(BUTTON_ADC);
+#ifdef CONFIG_APP_PM_STOP
+	if (wake) {
+		button_scan_enable(true);
+	}
+#endif
+	k_sem_take(&button_awd_sem, K_FOREVER);
+#ifdef CONFIG_APP_PM_STOP
+	if (wake) {
+		button_scan_enable(false);
+	}
+#endif
+}
+
+static inline int16_t button_adc_value(void)
+{
+	return LL_ADC_REG_ReadConversionData12(BUTTON_ADC);
+}
+
+/** Watch the "no button" band of the decoder table */
+static void button_awd_thresholds(void)
+{
+	int i;
+
+	for (i = 0; button_bands[i].type != BUTTON_NONE; i++) {
+	}
+
+	LL_ADC_SetAnalogWDThresholds(BUTTON_ADC, LL_ADC_AWD_THRESHOLD_LOW,
+				     button_bands[i].low);
+	LL_ADC_SetAnalogWDThresholds(BUTTON_ADC, LL_ADC_AWD_THRESHOLD_HIGH,
+				     (i < BUTTON_BANDS - 1) ?
+				     button_bands[i + 1].low - 1 : ADC_MAX);
+}
+
+static void button_func(void *adc_dev, void *cb_func, void *u3)
+{
+	struct button_state s = {
+		.dev = adc_dev,
+		.cb = cb_func,
+		.prev_type = BUTTON_NONE,
+	};
+
+	for(;;) {
+		button_stats.wakeups++;
+		if (button_sample(&s, button_adc_value(), k_cycle_get_32())) {
+			button_awd_wait();
 		}
-		prev_v = v;
-		k_msleep(50);
+		k_msleep(CONFIG_APP_BUTTON_HELD_MSEC);
 	}
 }
 
+static bool button_adc_init(void)
+{
+	if (!button_adc_setup()) {
+		return false;
+	}
+
+	LL_ADC_REG_SetContinuousMode(BUTTON_ADC, LL_ADC_REG_CONV_CONTINUOUS);
+
+	LL_ADC_SetAnalogWDMonitChannels(BUTTON_ADC, ADC_LL_AWD_CHANNEL);
+	button_awd_thresholds();
+
+	IRQ_CONNECT(BUTTON_ADC_IRQ, BUTTON_ADC_IRQ_PRIO, button_adc_isr, NULL, 0);
+	irq_enable(BUTTON_ADC_IRQ);
+
+	LL_ADC_Enable(BUTTON_ADC);
+	/* t_STAB */
+	k_busy_wait(3);
+	LL_ADC_REG_StartConversionSWStart(BUTTON_ADC);
+
+	return true;
+}
+
+#else
+static void button_awd_thresholds(void)
+{
+}
+#endif
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_DMA
+/* TIM3 triggers the conversions, DMA2 stream 0 writes them into a circular
+ * buffer. The half and full transfer interrupts filter each half with a
+ * median, so the cpu only runs once per block and not per sample. The
+ * thread is only woken while the level moves or a key is held.
+ */
+#define BUTTON_TRIG_TIMER	TIM3
+#define BUTTON_DMA		DMA2
+#define BUTTON_DMA_STREAM	LL_DMA_STREAM_0
+#define BUTTON_DMA_IRQ		DMA2_Stream0_IRQn
+#define BUTTON_DMA_IRQ_PRIO	2
+#define BUTTON_DMA_BLOCK	8
+#define BUTTON_DMA_SIZE		(2 * BUTTON_DMA_BLOCK)
+
+struct button_dma {
+	uint16_t samples[BUTTON_DMA_SIZE];
+	/* median of the last block and when it was complete */
+	volatile int16_t level;
+	volatile uint32_t cycles;
+	int16_t reported;
+	/* set by the thread, no wake-up while the level does not move */
+	volatile bool idle;
+	uint32_t blocks;
+	struct k_sem sem;
+};
+
+static struct button_dma button_dma;
+
+static int16_t button_median(const uint16_t *samples)
+{
+	uint16_t sorted[BUTTON_DMA_BLOCK];
+
+	/* insertion sort, the block is small */
+	for (int i = 0; i < BUTTON_DMA_BLOCK; i++) {
+		uint16_t v = samples[i];
+		int j = i;
+
+		while ((j > 0) && (sorted[j - 1] > v)) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = v;
+	}
+	return sorted[BUTTON_DMA_BLOCK / 2];
+}
+
+static void button_dma_isr(void *arg)
+{
+	const uint16_t *block;
+
+	ARG_UNUSED(arg);
+
+	if (LL_DMA_IsActiveFlag_HT0(BUTTON_DMA)) {
+		LL_DMA_ClearFlag_HT0(BUTTON_DMA);
+		block = &button_dma.samples[0];
+	} else if (LL_DMA_IsActiveFlag_TC0(BUTTON_DMA)) {
+		LL_DMA_ClearFlag_TC0(BUTTON_DMA);
+		block = &button_dma.samples[BUTTON_DMA_BLOCK];
+	} else {
+		LL_DMA_ClearFlag_TE0(BUTTON_DMA);
+		return;
+	}
+
+	button_dma.level = button_median(block);
+	button_dma.cycles = k_cycle_get_32();
+	button_dma.blocks++;
+
+	if (!button_dma.idle ||
+	    (diff(button_dma.level, button_dma.reported) >= ADC_DELTA)) {
+		button_dma.reported = button_dma.level;
+		k_sem_give(&button_dma.sem);
+	}
+}
+
+static inline int16_t button_adc_value(void)
+{
+	return button_dma.level;
+}
+
+static void button_func(void *adc_dev, void *cb_func, void *u3)
+{
+	struct button_state s = {
+		.dev = adc_dev,
+		.cb = cb_func,
+		.prev_type = BUTTON_NONE,
+	};
+
+	for(;;) {
+		k_sem_take(&button_dma.sem, K_FOREVER);
+		button_stats.wakeups++;
+		button_dma.idle = button_sample(&s, button_adc_value(),
+					       button_dma.cycles);
+	}
+}
+
+/** 1 MHz count on the APB1 timer clock */
+static void button_trig_timing(void)
+{
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB1,
+		.enr = LL_APB1_GRP1_PERIPH_TIM3
+	};
+	uint32_t rate;
+
+	if (clock_control_get_rate(button_clk, (clock_control_subsys_t *)&pclken, &rate)) {
+		return;
+	}
+
+	/* timers on a divided APB run at twice the bus clock */
+	if (LL_RCC_GetAPB1Prescaler() != LL_RCC_APB1_DIV_1) {
+		rate *= 2U;
+	}
+
+	LL_TIM_SetPrescaler(BUTTON_TRIG_TIMER, rate / USEC_PER_SEC - 1);
+}
+
+static bool button_adc_init(void)
+{
+	struct stm32_pclken tim_pclken = {
+		.bus = STM32_CLOCK_BUS_APB1,
+		.enr = LL_APB1_GRP1_PERIPH_TIM3
+	};
+	struct stm32_pclken dma_pclken = {
+		.bus = STM32_CLOCK_BUS_AHB1,
+		.enr = LL_AHB1_GRP1_PERIPH_DMA2
+	};
+
+	if (!button_adc_setup()) {
+		return false;
+	}
+
+	if (clock_control_on(button_clk, (clock_control_subsys_t *)&tim_pclken) ||
+	    clock_control_on(button_clk, (clock_control_subsys_t *)&dma_pclken)) {
+		LOG_ERR("Failed to clock adc trigger and dma");
+		return false;
+	}
+
+	k_sem_init(&button_dma.sem, 0, 1);
+
+	LL_DMA_SetChannelSelection(BUTTON_DMA, BUTTON_DMA_STREAM, LL_DMA_CHANNEL_0);
+	LL_DMA_ConfigTransfer(BUTTON_DMA, BUTTON_DMA_STREAM,
+			      LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+			      LL_DMA_MODE_CIRCULAR |
+			      LL_DMA_PERIPH_NOINCREMENT |
+			      LL_DMA_MEMORY_INCREMENT |
+			      LL_DMA_PDATAALIGN_HALFWORD |
+			      LL_DMA_MDATAALIGN_HALFWORD |
+			      LL_DMA_PRIORITY_LOW);
+	LL_DMA_ConfigAddresses(BUTTON_DMA, BUTTON_DMA_STREAM,
+			       LL_ADC_DMA_GetRegAddr(BUTTON_ADC, LL_ADC_DMA_REG_REGULAR_DATA),
+			       (uint32_t)button_dma.samples,
+			       LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+	LL_DMA_SetDataLength(BUTTON_DMA, BUTTON_DMA_STREAM, BUTTON_DMA_SIZE);
+	LL_DMA_EnableIT_HT(BUTTON_DMA, BUTTON_DMA_STREAM);
+	LL_DMA_EnableIT_TC(BUTTON_DMA, BUTTON_DMA_STREAM);
+	LL_DMA_EnableIT_TE(BUTTON_DMA, BUTTON_DMA_STREAM);
+
+	IRQ_CONNECT(BUTTON_DMA_IRQ, BUTTON_DMA_IRQ_PRIO, button_dma_isr, NULL, 0);
+	irq_enable(BUTTON_DMA_IRQ);
+	LL_DMA_EnableStream(BUTTON_DMA, BUTTON_DMA_STREAM);
+
+	/* one conversion per TIM3 update event */
+	LL_ADC_REG_SetContinuousMode(BUTTON_ADC, LL_ADC_REG_CONV_SINGLE);
+	LL_ADC_REG_SetTriggerSource(BUTTON_ADC, LL_ADC_REG_TRIG_EXT_TIM3_TRGO);
+	LL_ADC_REG_SetDMATransfer(BUTTON_ADC, LL_ADC_REG_DMA_TRANSFER_UNLIMITED);
+	LL_ADC_Enable(BUTTON_ADC);
+	/* t_STAB */
+	k_busy_wait(3);
+	LL_ADC_REG_StartConversionExtTrig(BUTTON_ADC, LL_ADC_REG_TRIG_EXT_RISING);
+
+	button_trig_timing();
+	LL_TIM_SetAutoReload(BUTTON_TRIG_TIMER,
+			     USEC_PER_SEC / CONFIG_APP_BUTTON_SAMPLE_HZ - 1);
+	LL_TIM_SetTriggerOutput(BUTTON_TRIG_TIMER, LL_TIM_TRGO_UPDATE);
+	LL_TIM_EnableCounter(BUTTON_TRIG_TIMER);
+
+	return true;
+}
+#endif
+
 K_THREAD_STACK_DEFINE(button_stack_area, BUTTON_STACK_SIZE);
 static struct k_thread button_thread_data;
 
 void *buttons_init(button_cb cb)
 {
+	button_bands_load();
+
+#ifdef CONFIG_APP_BUTTON_SAMPLING_POLL
 	int ret;
 	struct device *adc_dev = device_get_binding(ADC_DEVICE_NAME);
 
 	if (!adc_dev) {
-		printk("Failed to get adc dev\n");
+		LOG_ERR("Failed to get adc dev");
 		return NULL;
 	}
 
 	ret = adc_channel_setup(adc_dev, &adc_channel_cfg);
 
 	if (ret) {
-		printk("Failed to init adc\n");
+		LOG_ERR("Failed to init adc");
 		return NULL;
 	}
 
 	(void)memset(m_sample_buffer, 0, sizeof(m_sample_buffer));
+#else
+	/* the adc is driven directly, the handle is only passed to cb */
+	void *adc_dev = BUTTON_ADC;
+
+	if (!button_adc_init()) {
+		return NULL;
+	}
+#endif
+
+	button_stats.since_msec = k_uptime_get_32();
+
+	/* the sampling needs the ADC clock, see button_scan_enable() */
+	power_stop_lock();
 
 	k_thread_create(&button_thread_data, button_stack_area,
 			K_THREAD_STACK_SIZEOF(button_stack_area),
@@ -190,23 +930,81 @@ void *buttons_init(button_cb cb)
 
 bool buttons_poll(void *btn_dev, enum button_type *type)
 {
+#ifdef CONFIG_APP_BUTTON_SAMPLING_POLL
 	struct device* dev = btn_dev; 
 	int ret;
 	
 	ret = adc_read(dev, &sequence);
 
 	if (ret) {
-		printk("Failed to read from adc\n");
+		LOG_ERR("Failed to read from adc");
 		return false;
 	}
 
 	int16_t v = m_sample_buffer[0];
+#else
+	int16_t v = button_adc_value();
+#endif
+
+	LOG_DBG("Sample value %d", v);
+	*type = button_decode(v, BUTTON_NONE);
+	return true;
+}
+
+void buttons_set_active(void *dev, bool active)
+{
+	ARG_UNUSED(dev);
 
-	printk("Sample value %d\n", v);
-	if (button_decode(v, type)) {
-		return true;
+	button_active = active;
+#if defined(CONFIG_APP_BUTTON_SAMPLING_AWD) && defined(CONFIG_APP_PM_STOP)
+	/* wait again, with the wake-up for STOP */
+	if (!active) {
+		k_sem_give(&button_awd_sem);
 	}
+#endif
+}
 
-	printk("Cannot detect button for %d\n", v);
-	return false;
+void buttons_calibrate(void *dev, bool start)
+{
+	ARG_UNUSED(dev);
+
+	if (!start) {
+		if (button_cal_run.state == BUTTON_CAL_RUNNING) {
+			button_cal_run.state = BUTTON_CAL_IDLE;
+		}
+		return;
+	}
+
+	button_cal_run.step = 0;
+	button_cal_run.pressed = false;
+	button_cal_run.state = BUTTON_CAL_RUNNING;
+
+	/* the sampling thread may sleep until a key is pressed */
+#if defined(CONFIG_APP_BUTTON_SAMPLING_AWD)
+	k_sem_give(&button_awd_sem);
+#elif defined(CONFIG_APP_BUTTON_SAMPLING_DMA)
+	button_dma.idle = false;
+#endif
+}
+
+enum button_calibration buttons_calibration_state(void *dev, enum button_type *next)
+{
+	ARG_UNUSED(dev);
+
+	*next = button_cal_order[MIN(button_cal_run.step, BUTTON_BANDS - 1)];
+	return button_cal_run.state;
+}
+
+void buttons_stats_dump(void *dev)
+{
+	uint32_t secs = (k_uptime_get_32() - button_stats.since_msec) / MSEC_PER_SEC;
+
+	ARG_UNUSED(dev);
+
+	LOG_INF("Buttons: %u wake-ups in %u s, %u per hour",
+		button_stats.wakeups, secs,
+		secs ? (uint32_t)((uint64_t)button_stats.wakeups * 3600U / secs) : 0);
+#ifdef CONFIG_APP_BUTTON_SAMPLING_DMA
+	LOG_INF("  %u dma blocks filtered", button_dma.blocks);
+#endif
 }
@@ -21,10 +21,41 @@ enum button_type {
 #define BUTTON_RELEASED false
 #define BUTTON_PRESSED true
 
-typedef void (button_cb)(void* dev, enum button_type, bool);
+/** Called on press and release, while a key is held the press is repeated
+ * with an increasing repeat count. cycles is k_cycle_get_32() when the
+ * deciding sample was taken.
+ */
+typedef void (button_cb)(void* dev, enum button_type, bool, uint8_t repeat,
+			 uint32_t cycles);
 
 void *buttons_init(button_cb cb);
 
 bool buttons_poll(void *dev, enum button_type *type);
 
+/** Poll faster while the display is lit, the user is about to press keys */
+void buttons_set_active(void *dev, bool active);
+
+enum button_calibration {
+	BUTTON_CAL_IDLE,
+	BUTTON_CAL_RUNNING,
+	BUTTON_CAL_DONE,
+	BUTTON_CAL_FAILED,
+};
+
+/** Learn the levels of the resistor ladder
+ *
+ * While running no keys are reported. First the idle level is taken, then
+ * each key has to be pressed and released in the order given by
+ * buttons_calibration_state(). Each step is reported as a release of
+ * BUTTON_NONE. The result is stored in the RTC backup registers.
+ * start = false cancels, this may be called from an isr.
+ */
+void buttons_calibrate(void *dev, bool start);
+
+/** Get the calibration state and the key that is expected next */
+enum button_calibration buttons_calibration_state(void *dev, enum button_type *next);
+
+/** Print the sampling thread wake-ups */
+void buttons_stats_dump(void *dev);
+
 #endif /*APP_BUTTONS_H*/
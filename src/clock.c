@@ -4,6 +4,9 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <logging/log.h>
+LOG_MODULE_REGISTER(clock, CONFIG_APP_IO_LOG_LEVEL);
+
 #include "clock.h"
 
 #include <drivers/counter.h>
@@ -50,6 +53,10 @@ struct tm* clock_rtc_read(void* dev)
 	return &now;
 }
 
+#ifdef CONFIG_COUNTER_RTC_STM32
+static void clock_wakeup_restart(const struct tm *now);
+#endif
+
 void clock_rtc_set(void *dev, const struct tm *now)
 {
 	ARG_UNUSED(now);
@@ -58,7 +65,14 @@ void clock_rtc_set(void *dev, const struct tm *now)
 	//BCD Format!!! 23 uhr = 0x23
 	LL_RTC_EnableInitMode(RTC);
 
-	k_msleep(100);
+	/* takes about 2 RTCCLK cycles */
+	for (int i = 0; !LL_RTC_IsActiveFlag_INIT(RTC); i++) {
+		if (i >= 1000) {
+			LOG_ERR("Failed to enter RTC init mode");
+			break;
+		}
+		k_busy_wait(1);
+	}
 	LL_RTC_TIME_Config(RTC, LL_RTC_TIME_FORMAT_AM_OR_24,
 			   __LL_RTC_CONVERT_BIN2BCD(now->tm_hour),
 			   __LL_RTC_CONVERT_BIN2BCD(now->tm_min),
@@ -71,38 +85,287 @@ void clock_rtc_set(void *dev, const struct tm *now)
 			   __LL_RTC_CONVERT_BIN2BCD(now->tm_year - 100));
 	LL_RTC_DisableInitMode(RTC);
 	LL_RTC_EnableWriteProtection(RTC);
+
+#ifdef CONFIG_COUNTER_RTC_STM32
+	clock_wakeup_restart(now);
+#endif
 }
 
-bool clock_rtc_reg_read(void* buffer, size_t len)
+bool clock_rtc_reg_read(uint8_t reg, void* buffer, size_t len)
 {
-	if (len > 18 * 4) {
-		printk("Trying to read too much data");
+	if ((reg * 4 + len) > CLOCK_RTC_REGS * 4) {
+		LOG_ERR("Trying to read too much data");
 		return false;
 	}
 	uint32_t data;
 	for (size_t i = 0; i < len; i += 4) {
-		data = LL_RTC_BAK_GetRegister(RTC, LL_RTC_BKP_DR0 + (i / 4));
+		data = LL_RTC_BAK_GetRegister(RTC, LL_RTC_BKP_DR0 + reg + (i / 4));
 		memcpy((uint8_t*)buffer + i, &data, (len - i) >= 4 ? 4 : len - i);
 	}
 	return true;
 
 }
 
-bool clock_rtc_reg_write(const void* buffer, size_t len)
+bool clock_rtc_reg_write(uint8_t reg, const void* buffer, size_t len)
 {
-	if (len > 18 * 4) {
-		printk("Trying to store too much data");
+	if ((reg * 4 + len) > CLOCK_RTC_REGS * 4) {
+		LOG_ERR("Trying to store too much data");
 		return false;
 	}
 	uint32_t data = 0;
 	for (size_t i = 0; i < len; i +=4) {
 		data = 0;
 		memcpy(&data, (const uint8_t*) buffer + i, (len - i) >= 4 ? 4 : len - i);
-		LL_RTC_BAK_SetRegister(RTC, LL_RTC_BKP_DR0 + (i / 4), data);
+		LL_RTC_BAK_SetRegister(RTC, LL_RTC_BKP_DR0 + reg + (i / 4), data);
+	}
+	return true;
+}
+
+static bool clock_sram_init(void)
+{
+	LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_PWR);
+	LL_PWR_EnableBkUpAccess();
+	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_BKPSRAM);
+
+	/* without the regulator the sram is lost when VDD goes away */
+	LL_PWR_EnableBkUpRegulator();
+	for (int i = 0; !LL_PWR_IsActiveFlag_BRR(); i++) {
+		if (i >= 1000) {
+			LOG_ERR("Backup regulator not ready");
+			return false;
+		}
+		k_busy_wait(1);
 	}
 	return true;
 }
 
+bool clock_sram_read(size_t offset, void* buffer, size_t len)
+{
+	if ((offset + len) > CLOCK_SRAM_SIZE) {
+		LOG_ERR("Trying to read too much data");
+		return false;
+	}
+	memcpy(buffer, (const uint8_t*)BKPSRAM_BASE + offset, len);
+	return true;
+}
+
+bool clock_sram_write(size_t offset, const void* buffer, size_t len)
+{
+	if ((offset + len) > CLOCK_SRAM_SIZE) {
+		LOG_ERR("Trying to store too much data");
+		return false;
+	}
+	memcpy((uint8_t*)BKPSRAM_BASE + offset, buffer, len);
+	return true;
+}
+
+#endif
+
+/* Alarm A, the counter driver owns its interrupt */
+static clock_alarm_cb *clock_alarm_func;
+
+static void clock_alarm_handler(struct device *dev, uint8_t chan_id,
+				uint32_t ticks, void *user_data)
+{
+	clock_alarm_func(user_data);
+}
+
+bool clock_rtc_alarm_set(void *dev, uint32_t secs, clock_alarm_cb *cb, void *user_data)
+{
+	struct counter_alarm_cfg alarm_cfg = {
+		.callback = clock_alarm_handler,
+		.ticks = counter_us_to_ticks(dev, (uint64_t)secs * USEC_PER_SEC),
+		.user_data = user_data,
+		.flags = 0,
+	};
+	int ret;
+
+	(void)counter_cancel_channel_alarm(dev, 0);
+	clock_alarm_func = cb;
+	ret = counter_set_channel_alarm(dev, 0, &alarm_cfg);
+	if (ret) {
+		LOG_ERR("Failed to set rtc alarm (%d)", ret);
+		return false;
+	}
+	return true;
+}
+
+#ifdef CONFIG_COUNTER_RTC_STM32
+/* Wakeup timer, not used by the counter driver. It counts ck_spre for the
+ * periodic callback. While a scan runs it counts RTCCLK / 16 with the scan
+ * period, the periodic callback is then due by the RTC time of day. Its
+ * phase survives switching between both.
+ */
+#define CLOCK_WAKEUP_IRQ	RTC_WKUP_IRQn
+#define CLOCK_WAKEUP_IRQ_PRIO	2
+#define CLOCK_WAKEUP_EXTI	LL_EXTI_LINE_22
+/* largest reload with 1 Hz */
+#define CLOCK_WAKEUP_MAX_SECS	0x10000
+#define CLOCK_SECS_PER_DAY	(24U * 60U * 60U)
+#if defined(CONFIG_COUNTER_RTC_STM32_CLOCK_LSI)
+#define CLOCK_WAKEUP_DIV16_HZ	(32000U / 16U)
+#else
+#define CLOCK_WAKEUP_DIV16_HZ	(32768U / 16U)
+#endif
+#define CLOCK_SCAN_MAX_MSEC	(0x10000U * MSEC_PER_SEC / CLOCK_WAKEUP_DIV16_HZ)
+
+static clock_alarm_cb *clock_wakeup_func;
+static void *clock_wakeup_data;
+static uint32_t clock_wakeup_secs;
+/* second of the day of the next periodic call */
+static uint32_t clock_wakeup_due;
+/* ck_spre reload is the time up to clock_wakeup_due, not the period */
+static bool clock_wakeup_partial;
+
+static clock_alarm_cb *clock_scan_func;
+static void *clock_scan_data;
+static uint32_t clock_scan_msec;
+
+/** Second of the day, DR is read to unlock the shadow registers */
+static uint32_t clock_rtc_secs(void)
+{
+	uint32_t time = LL_RTC_TIME_Get(RTC);
+
+	(void)LL_RTC_DATE_Get(RTC);
+	return (__LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_HOUR(time)) * 60U +
+		__LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_MINUTE(time))) * 60U +
+	       __LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_SECOND(time));
+}
+
+/** Seconds from now up to clock_wakeup_due, 0 if it passed */
+static uint32_t clock_wakeup_left(uint32_t now)
+{
+	uint32_t left = (clock_wakeup_due + CLOCK_SECS_PER_DAY - now) % CLOCK_SECS_PER_DAY;
+
+	return (left > CLOCK_WAKEUP_MAX_SECS) ? 0 : left;
+}
+
+/** Program the timer for the current clients, interrupts locked
+ *
+ * left is the time up to the next periodic call, 0 to take it from the RTC.
+ */
+static void clock_wakeup_program(uint32_t left)
+{
+	LL_RTC_DisableWriteProtection(RTC);
+	LL_RTC_WAKEUP_Disable(RTC);
+	while (!LL_RTC_IsActiveFlag_WUTW(RTC)) {
+	}
+
+	clock_wakeup_partial = false;
+	if (clock_scan_func) {
+		LL_RTC_WAKEUP_SetAutoReload(RTC, clock_scan_msec * CLOCK_WAKEUP_DIV16_HZ /
+					    MSEC_PER_SEC - 1);
+		LL_RTC_WAKEUP_SetClock(RTC, LL_RTC_WAKEUPCLOCK_DIV_16);
+	} else if (clock_wakeup_func) {
+		/* fires on the (reload + 1)th second edge */
+		if (!left) {
+			left = MAX(clock_wakeup_left(clock_rtc_secs()), 1U);
+		}
+		clock_wakeup_partial = (left != clock_wakeup_secs);
+		LL_RTC_WAKEUP_SetAutoReload(RTC, left - 1);
+		LL_RTC_WAKEUP_SetClock(RTC, LL_RTC_WAKEUPCLOCK_CKSPRE);
+	} else {
+		LL_RTC_DisableIT_WUT(RTC);
+		LL_RTC_EnableWriteProtection(RTC);
+		return;
+	}
+
+	LL_RTC_ClearFlag_WUT(RTC);
+	LL_RTC_EnableIT_WUT(RTC);
+	LL_RTC_WAKEUP_Enable(RTC);
+	LL_RTC_EnableWriteProtection(RTC);
+}
+
+static void clock_wakeup_isr(void *arg)
+{
+	ARG_UNUSED(arg);
+
+	LL_RTC_ClearFlag_WUT(RTC);
+	LL_EXTI_ClearFlag_0_31(CLOCK_WAKEUP_EXTI);
+
+	if (clock_scan_func) {
+		clock_scan_func(clock_scan_data);
+		if (!clock_wakeup_func || clock_wakeup_left(clock_rtc_secs())) {
+			return;
+		}
+	}
+
+	if (clock_wakeup_func) {
+		clock_wakeup_due = (clock_wakeup_due + clock_wakeup_secs) % CLOCK_SECS_PER_DAY;
+		if (clock_wakeup_partial) {
+			/* the rest of a period after a scan, whole periods from now */
+			clock_wakeup_program(clock_wakeup_secs);
+		}
+		clock_wakeup_func(clock_wakeup_data);
+	}
+}
+
+bool clock_rtc_wakeup_set(void *dev, uint32_t secs, clock_alarm_cb *cb, void *user_data)
+{
+	unsigned int key;
+
+	ARG_UNUSED(dev);
+
+	if (secs > CLOCK_WAKEUP_MAX_SECS) {
+		LOG_ERR("Wakeup period too long (%u s)", secs);
+		return false;
+	}
+	/* a running period keeps its phase */
+	if ((secs == clock_wakeup_secs) && (cb == clock_wakeup_func) &&
+	    (user_data == clock_wakeup_data)) {
+		return true;
+	}
+
+	key = irq_lock();
+	clock_wakeup_func = secs ? cb : NULL;
+	clock_wakeup_data = user_data;
+	clock_wakeup_secs = secs;
+	clock_wakeup_due = (clock_rtc_secs() + secs) % CLOCK_SECS_PER_DAY;
+	clock_wakeup_program(secs);
+	irq_unlock(key);
+	return true;
+}
+
+/** The due time of day moved with the clock, count a whole period from now */
+static void clock_wakeup_restart(const struct tm *now)
+{
+	unsigned int key = irq_lock();
+
+	if (clock_wakeup_func) {
+		clock_wakeup_due = ((now->tm_hour * 60U + now->tm_min) * 60U + now->tm_sec +
+				    clock_wakeup_secs) % CLOCK_SECS_PER_DAY;
+		clock_wakeup_program(clock_wakeup_secs);
+	}
+	irq_unlock(key);
+}
+
+bool clock_rtc_scan_set(uint32_t msec, clock_alarm_cb *cb, void *user_data)
+{
+	unsigned int key;
+
+	if (msec > CLOCK_SCAN_MAX_MSEC) {
+		LOG_ERR("Scan period too long (%u ms)", msec);
+		return false;
+	}
+
+	key = irq_lock();
+	clock_scan_func = msec ? cb : NULL;
+	clock_scan_data = user_data;
+	clock_scan_msec = msec;
+	clock_wakeup_program(0);
+	irq_unlock(key);
+	return true;
+}
+
+static void clock_wakeup_init(void)
+{
+	/* the wakeup flag reaches the NVIC through EXTI line 22 */
+	LL_EXTI_EnableIT_0_31(CLOCK_WAKEUP_EXTI);
+	LL_EXTI_EnableRisingTrig_0_31(CLOCK_WAKEUP_EXTI);
+
+	IRQ_CONNECT(CLOCK_WAKEUP_IRQ, CLOCK_WAKEUP_IRQ_PRIO, clock_wakeup_isr, NULL, 0);
+	irq_enable(CLOCK_WAKEUP_IRQ);
+}
 #endif
 
 void* clock_init(void)
@@ -110,9 +373,16 @@ void* clock_init(void)
 	struct device *rtc_dev = device_get_binding(RTC_DEVICE_NAME);
 
 	if (!rtc_dev) {
-		printk("Failed to get adc dev\n");
+		LOG_ERR("Failed to get adc dev");
+		return NULL;
+	}
+
+#ifdef CONFIG_COUNTER_RTC_STM32
+	if (!clock_sram_init()) {
 		return NULL;
 	}
+	clock_wakeup_init();
+#endif
 
 	return rtc_dev;
 }
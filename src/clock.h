@@ -9,6 +9,7 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 void* clock_init(void);
 
@@ -16,8 +17,43 @@ struct tm* clock_rtc_read(void* dev);
 
 void clock_rtc_set(void *dev, const struct tm *now);
 
-bool clock_rtc_reg_read(void* buffer, size_t len);
+typedef void (clock_alarm_cb)(void *user_data);
 
-bool clock_rtc_reg_write(const void* buffer, size_t len);
+/** Call cb from the RTC alarm interrupt in secs seconds, replaces the
+ * pending alarm
+ */
+bool clock_rtc_alarm_set(void *dev, uint32_t secs, clock_alarm_cb *cb, void *user_data);
+
+/** Call cb from the RTC wakeup interrupt every secs seconds, 0 stops it
+ *
+ * The wakeup timer counts RTC seconds, the first call is secs seconds
+ * after the current second started.
+ */
+bool clock_rtc_wakeup_set(void *dev, uint32_t secs, clock_alarm_cb *cb, void *user_data);
+
+/** Call cb from the RTC wakeup interrupt every msec ms as well, 0 stops it
+ *
+ * Meant for short wake-ups from STOP, the periodic call of
+ * clock_rtc_wakeup_set() keeps its phase meanwhile.
+ */
+bool clock_rtc_scan_set(uint32_t msec, clock_alarm_cb *cb, void *user_data);
+
+/* RTC backup registers, 4 bytes each, kept as long as VBAT is present */
+#define CLOCK_RTC_REGS			20
+#define CLOCK_RTC_REG_SETTINGS		0	/* controller settings */
+#define CLOCK_RTC_REG_BUTTONS		8	/* keypad calibration */
+#define CLOCK_RTC_REG_BOOST		14	/* temporary day/night override */
+
+bool clock_rtc_reg_read(uint8_t reg, void* buffer, size_t len);
+
+bool clock_rtc_reg_write(uint8_t reg, const void* buffer, size_t len);
+
+/* 4 KB backup sram, kept on VBAT by the backup regulator */
+#define CLOCK_SRAM_SIZE			4096
+#define CLOCK_SRAM_SCHEDULE		0	/* weekly schedule */
+
+bool clock_sram_read(size_t offset, void* buffer, size_t len);
+
+bool clock_sram_write(size_t offset, const void* buffer, size_t len);
 
 #endif /* APP_CLOCK_H */
@@ -5,15 +5,19 @@
  */
 
 #include <logging/log.h>
-LOG_MODULE_REGISTER(ctr, CONFIG_LOG_DEFAULT_LEVEL);
+LOG_MODULE_REGISTER(ctr, CONFIG_APP_CTRL_LOG_LEVEL);
 
 #include "controller.h"
 
 #include "lcd.h"
+#include "display.h"
 #include "buttons.h"
 #include "clock.h"
 #include "output.h"
+#include "power.h"
+#include "schedule.h"
 
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -25,29 +29,94 @@ static const char* DAY_STR[] =
 {"So", "Mo", "Di", "Mi", "Do", "Fr", "Sa"};
 
 static const char* MODE_STR[] =
-{"Aus", "Tag", "Nacht"};
+{"Frost", "Tag", "Nacht"};
+
+static const char* MODE_GLYPH[] =
+{LCD_GLYPH_STR_FROST, LCD_GLYPH_STR_SUN, LCD_GLYPH_STR_MOON};
+
+/* indexed by enum schedule_mode */
+static const char* SCHEDULE_STR[] =
+{"Nacht", "Tag", "Frost"};
+
+/* indexed by enum button_type */
+static const char* BUTTON_STR[] =
+{"keine", "Select", "Links", "Rechts", "Hoch", "Runter"};
 
 enum op_mode {
-	OP_MODE_OFF = 0,
+	OP_MODE_OFF = 0,	/* frost protection */
 	OP_MODE_DAY,
 	OP_MODE_NIGHT
 };
 
+/* calendar day, day 0 is unset */
+struct ctrl_date {
+	uint8_t year;	/* since 2000 */
+	uint8_t month;	/* 1-12 */
+	uint8_t day;	/* 1-31 */
+};
+
+enum ctrl_override {
+	CTRL_OVERRIDE_NONE = 0,
+	CTRL_OVERRIDE_AWAY,	/* frost protection all day */
+	CTRL_OVERRIDE_ECO,	/* night instead of day */
+};
+
+struct ctrl_settings {
+	/* backlight brightness in percent */
+	uint8_t backlight_active;
+	uint8_t backlight_idle;
+	/* away from begin to end, both days included */
+	struct ctrl_date away_begin;
+	struct ctrl_date away_end;
+	/* eco up to and including this day */
+	struct ctrl_date eco_until;
+};
+
+/* A new field gets a new version and a case in ctrl_settings_load(), the
+ * magic stays. Up to version 4 the magic itself was bumped instead.
+ */
+#define PERSISTENT_SETTINGS_MAGIC (0xAA555E77)
+#define PERSISTENT_SETTINGS_VERSION 4
+#define PERSISTENT_SETTINGS_MAGIC_OLD(version) (0xAA551233 + (version))
+
+#define BACKLIGHT_PERCENT_STEP 10
+
+struct persistent_ctrl_settings {
+	uint32_t magic_no;
+	uint8_t version;
+	struct ctrl_settings settings;
+} __attribute__((packed));
+
+/* Layouts of the older versions */
 struct ctrl_time {
 	uint8_t hour;
 	uint8_t minute;
 };
 
-struct ctrl_settings {
+struct ctrl_settings_v1 {
+	/* day window, replaced by the weekly schedule in version 3 */
 	struct ctrl_time day_begin;
 	struct ctrl_time day_end;
 };
 
-#define PERSISTENT_SETTINGS_MAGIC (0xAA551234)
+struct ctrl_settings_v2 {
+	struct ctrl_time day_begin;
+	struct ctrl_time day_end;
+	uint8_t backlight_active;
+	uint8_t backlight_idle;
+};
 
-struct persistent_ctrl_settings {
+struct ctrl_settings_v3 {
+	uint8_t backlight_active;
+	uint8_t backlight_idle;
+};
+
+#define PERSISTENT_BOOST_MAGIC (0xAA55B005)
+
+struct persistent_ctrl_boost {
 	uint32_t magic_no;
-	struct ctrl_settings settings;
+	uint32_t end;
+	uint8_t mode;
 } __attribute__((packed));
 
 struct cursor {
@@ -61,18 +130,35 @@ enum input_mode {
 	INPUT_MODE_EDIT_CLOCK_HOUR,
 	INPUT_MODE_EDIT_CLOCK_MINUTE,
 	INPUT_MODE_EDIT_DAY,
+	INPUT_MODE_EDIT_DATE,
+	INPUT_MODE_EDIT_SCHEDULE_DAY,
+	INPUT_MODE_EDIT_SCHEDULE_INTERVAL,
+	INPUT_MODE_EDIT_SCHEDULE_MODE,
 	INPUT_MODE_EDIT_SCHEDULE_BEGIN_HOUR,
 	INPUT_MODE_EDIT_SCHEDULE_BEGIN_MINUTE,
 	INPUT_MODE_EDIT_SCHEDULE_END_HOUR,
 	INPUT_MODE_EDIT_SCHEDULE_END_MINUTE,
+	INPUT_MODE_EDIT_AWAY_BEGIN,
+	INPUT_MODE_EDIT_AWAY_END,
+	INPUT_MODE_EDIT_ECO_UNTIL,
+	INPUT_MODE_EDIT_BACKLIGHT_ACTIVE,
+	INPUT_MODE_EDIT_BACKLIGHT_IDLE,
+	INPUT_MODE_CALIBRATE_BUTTONS,
 	INPUT_MODE_LAST //must be always last entry
 };
 
+/* fields of the clock changed in edit mode */
+#define CTRL_EDIT_HOUR		BIT(0)
+#define CTRL_EDIT_MINUTE	BIT(1)
+#define CTRL_EDIT_WDAY		BIT(2)
+#define CTRL_EDIT_DATE		BIT(3)
+
 struct ctx {
-	void* lcd;
+	void* display;
 	void* buttons;
 	void* output;
 	void* clock;
+	void* schedule;
 
 	struct cursor cursor;
 
@@ -80,17 +166,67 @@ struct ctx {
 	struct ctrl_settings settings;
 
 	enum input_mode input_mode;
+
+	/* edits of a held key, written to the RTC on release */
+	struct tm edit_clock;
+	uint8_t clock_edits;		/* CTRL_EDIT_* fields of edit_clock */
+	bool settings_dirty;
+	bool schedule_dirty;
+	bool repeated;
+
+	/* day or night up to boost_end, in minutes of ctrl_minutes() */
+	enum op_mode boost_mode;
+	uint32_t boost_end;
+
+	/* interval on the schedule pages */
+	uint8_t schedule_day;
+	uint8_t schedule_interval;
+
+	/* the next mode change has to be programmed into the RTC alarm */
+	bool alarm_dirty;
+	/* loop wake-ups by cause */
+	uint32_t wake_button;
+	uint32_t wake_alarm;
+	uint32_t wake_tick;
+
+	/* input timer ran out, the backlight is at the idle level */
+	bool idle;
 };
 
 static struct ctx ctrl_ctx;
 
-struct msgq_item_t {
+struct ctrl_event {
 	uint8_t button_index;
 	uint8_t button_pressed;
+	uint8_t repeat;
+	/* sample time, the duration is filled in by the controller thread */
+	uint32_t cycles;
 	uint32_t duration_msec;
 };
 
-K_MSGQ_DEFINE(ctrl_msgq, sizeof(struct msgq_item_t), 30, 4);
+/* Lock-free ring, the button thread is the only producer and the controller
+ * thread the only consumer. head is only written by the producer, tail only
+ * by the consumer. A full ring drops the new event and counts it.
+ */
+#define CTRL_EVENTS 32		/* power of two */
+
+struct ctrl_event_ring {
+	struct ctrl_event items[CTRL_EVENTS];
+	atomic_t head;
+	atomic_t tail;
+	atomic_t overflows;
+	/* set by the RTC alarm, it shares the semaphore */
+	atomic_t alarm;
+	/* set by the refresh ticks of the RTC wakeup timer */
+	atomic_t tick;
+	struct k_sem sem;
+	/* start of the current press, consumer only */
+	uint32_t press_cycles;
+	uint32_t press_msec;
+	uint32_t press_switches;
+};
+
+static struct ctrl_event_ring ctrl_events;
 
 K_THREAD_STACK_DEFINE(ctrl_stack_area, CTRL_STACK_SIZE);
 static struct k_thread ctrl_thread_data;
@@ -99,6 +235,96 @@ static void user_input_expiry_function(struct k_timer *timer_id);
 
 K_TIMER_DEFINE(user_input_timer, user_input_expiry_function, NULL);
 
+/** Comparable value of a date, 0 if unset */
+static uint16_t ctrl_date_key(const struct ctrl_date *date)
+{
+	if (!date->day) {
+		return 0;
+	}
+	return (date->year << 9) | (date->month << 5) | date->day;
+}
+
+static struct ctrl_date ctrl_date_of(const struct tm *now)
+{
+	struct ctrl_date date = {
+		.year = now->tm_year - 100,
+		.month = now->tm_mon + 1,
+		.day = now->tm_mday,
+	};
+
+	return date;
+}
+
+/** Away or eco override of the schedule for today */
+static enum ctrl_override ctrl_override_get(const struct ctrl_settings *settings,
+					    const struct tm *now)
+{
+	struct ctrl_date today = ctrl_date_of(now);
+	uint16_t key = ctrl_date_key(&today);
+	uint16_t away_begin = ctrl_date_key(&settings->away_begin);
+
+	if (away_begin && (key >= away_begin) &&
+	    (key <= ctrl_date_key(&settings->away_end))) {
+		return CTRL_OVERRIDE_AWAY;
+	}
+	if (key <= ctrl_date_key(&settings->eco_until)) {
+		return CTRL_OVERRIDE_ECO;
+	}
+	return CTRL_OVERRIDE_NONE;
+}
+
+/** An override is active or starts later, so it changes at midnight */
+static bool ctrl_override_pending(const struct ctrl_settings *settings,
+				  const struct tm *now)
+{
+	struct ctrl_date today = ctrl_date_of(now);
+	uint16_t key = ctrl_date_key(&today);
+
+	return (key <= ctrl_date_key(&settings->away_end)) ||
+	       (key <= ctrl_date_key(&settings->eco_until));
+}
+
+/** Minutes since 2000-01-01, valid up to 2099 */
+static uint32_t ctrl_minutes(const struct tm *now)
+{
+	static const uint16_t days_before[] =
+		{0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+	uint32_t year = now->tm_year - 100;
+	uint32_t days = year * 365 + (year + 3) / 4 + days_before[now->tm_mon] +
+			now->tm_mday - 1;
+
+	if (((year % 4) == 0) && (now->tm_mon > 1)) {
+		days++;
+	}
+	return (days * 24 + now->tm_hour) * 60 + now->tm_min;
+}
+
+/** Seconds left of the boost, 0 if there is none */
+static uint32_t ctrl_boost_remaining(const struct tm *now)
+{
+	uint32_t minutes = ctrl_minutes(now);
+
+	if (ctrl_ctx.boost_end <= minutes) {
+		return 0;
+	}
+	return (ctrl_ctx.boost_end - minutes) * 60 - now->tm_sec;
+}
+
+static void ctrl_date_str(char *buf, size_t len, const struct ctrl_date *date)
+{
+	if (!date->day) {
+		snprintf(buf, len, "   aus  ");
+	} else {
+		snprintf(buf, len, "%02d.%02d.%02d", date->day, date->month, date->year);
+	}
+}
+
+static bool ctrl_clock_page(enum input_mode input_mode)
+{
+	return (input_mode >= INPUT_MODE_EDIT_CLOCK_HOUR) &&
+	       (input_mode <= INPUT_MODE_EDIT_DAY);
+}
+
 #if 0
 void show_date_time(void *lcd, struct tm *now)
 {
@@ -118,48 +344,236 @@ void show_date_time(void *lcd, struct tm *now)
 }
 #endif
 
-void show_main_screen(struct ctx *ctx, struct tm *now)
+void show_main_screen(struct ctx *ctx, struct tm *now, struct display_state *screen)
 {
-	static char line1[17];
-	static char line2[17];
+	char *line1 = screen->lines[0];
+	char *line2 = screen->lines[1];
 
-	snprintf(line1, sizeof(line1), "%02d:%02d  %s  %s",
-		 now->tm_hour, now->tm_min, DAY_STR[now->tm_wday], MODE_STR[ctx->mode]);
+	if (ctrl_clock_page(ctx->input_mode)) {
+		/* seconds only while setting the clock, they tick at 1 Hz */
+		snprintf(line1, sizeof(screen->lines[0]), "%02d:%02d:%02d %s %s",
+			 now->tm_hour, now->tm_min, now->tm_sec, DAY_STR[now->tm_wday],
+			 MODE_GLYPH[ctx->mode]);
+	} else {
+		snprintf(line1, sizeof(screen->lines[0]), "%02d:%02d  %s %s%s",
+			 now->tm_hour, now->tm_min, DAY_STR[now->tm_wday],
+			 MODE_GLYPH[ctx->mode], MODE_STR[ctx->mode]);
+	}
 
-	line1[sizeof(line1) - 1] = '\0';
-	snprintf(line2, sizeof(line2), " %02d:%02d - %02d:%02d",
-		ctx->settings.day_begin.hour, ctx->settings.day_begin.minute,
-		ctx->settings.day_end.hour, ctx->settings.day_end.minute
-		);
-	line2[sizeof(line2) - 1] = '\0';
-	
-	//lcd_clear(lcd);
-	/*k_msleep(MSEC_PER_SEC * 3U);*/
-	lcd_set_cursor(ctx->lcd, 0, 0);
-	
-	lcd_string(ctx->lcd, line1);
-	lcd_set_cursor(ctx->lcd, 0, 1);
-	lcd_string(ctx->lcd, line2);
+	uint32_t boost = ctrl_boost_remaining(now);
+
+	if (boost) {
+		boost = (boost + 59) / 60;
+		snprintf(line2, sizeof(screen->lines[1]), " %s noch %d:%02d",
+			 MODE_STR[ctx->boost_mode], boost / 60, boost % 60);
+		return;
+	}
+
+	switch (ctrl_override_get(&ctx->settings, now)) {
+	case CTRL_OVERRIDE_AWAY:
+		snprintf(line2, sizeof(screen->lines[1]), " Weg bis %02d.%02d.",
+			 ctx->settings.away_end.day, ctx->settings.away_end.month);
+		return;
+	case CTRL_OVERRIDE_ECO:
+		snprintf(line2, sizeof(screen->lines[1]), " Eco bis %02d.%02d.",
+			 ctx->settings.eco_until.day, ctx->settings.eco_until.month);
+		return;
+	case CTRL_OVERRIDE_NONE:
+	default:
+		break;
+	}
+
+	/* end of the current mode */
+	uint32_t secs = schedule_next_change(ctx->schedule, now);
+	uint32_t minute = (now->tm_wday * 24 * 60 + now->tm_hour * 60 + now->tm_min) +
+			  (now->tm_sec + secs) / 60;
+
+	minute %= SCHEDULE_DAYS * 24 * 60;
+	snprintf(line2, sizeof(screen->lines[1]), " bis %s %02d:%02d",
+		 DAY_STR[minute / (24 * 60)], (minute / 60) % 24, minute % 60);
+}
+
+void show_schedule_screen(struct ctx *ctx, struct display_state *screen)
+{
+	const struct schedule_interval *iv =
+		&schedule_get(ctx->schedule)->days[ctx->schedule_day][ctx->schedule_interval];
+	uint16_t begin = iv->begin * SCHEDULE_SLOT_MIN;
+	uint16_t end = iv->end * SCHEDULE_SLOT_MIN;
+
+	snprintf(screen->lines[0], sizeof(screen->lines[0]), "Plan %s #%d %s",
+		 DAY_STR[ctx->schedule_day], ctx->schedule_interval + 1,
+		 SCHEDULE_STR[iv->mode % SCHEDULE_MODES]);
+	snprintf(screen->lines[1], sizeof(screen->lines[1]), " %02d:%02d - %02d:%02d",
+		 begin / 60, begin % 60, end / 60, end % 60);
 }
 
-void ctrl_button_handler(void* dev, enum button_type type, bool pressed)
+void show_date_screen(struct ctx *ctx, struct tm *now, struct display_state *screen)
 {
-	static struct msgq_item_t tx_data;
-	static int64_t last_button_event = 0;
-	if (pressed) {
-		last_button_event = k_uptime_get();
+	struct ctrl_date today = ctrl_date_of(now);
+	char date1[9];
+	char date2[9];
+
+	switch (ctx->input_mode) {
+	case INPUT_MODE_EDIT_DATE:
+		ctrl_date_str(date1, sizeof(date1), &today);
+		snprintf(screen->lines[0], sizeof(screen->lines[0]), "Datum   %s", date1);
+		snprintf(screen->lines[1], sizeof(screen->lines[1]), "        %s",
+			 DAY_STR[now->tm_wday]);
+		break;
+	case INPUT_MODE_EDIT_AWAY_BEGIN:
+	case INPUT_MODE_EDIT_AWAY_END:
+		ctrl_date_str(date1, sizeof(date1), &ctx->settings.away_begin);
+		ctrl_date_str(date2, sizeof(date2), &ctx->settings.away_end);
+		snprintf(screen->lines[0], sizeof(screen->lines[0]), "Weg ab  %s", date1);
+		snprintf(screen->lines[1], sizeof(screen->lines[1]), "Weg bis %s", date2);
+		break;
+	case INPUT_MODE_EDIT_ECO_UNTIL:
+	default:
+		ctrl_date_str(date1, sizeof(date1), &ctx->settings.eco_until);
+		snprintf(screen->lines[0], sizeof(screen->lines[0]), "Eco bis %s", date1);
+		snprintf(screen->lines[1], sizeof(screen->lines[1]), "Tag als Nacht");
+		break;
 	}
-	tx_data.button_index = type;
-	tx_data.button_pressed = pressed;
-	tx_data.duration_msec = (uint32_t) k_uptime_delta(&last_button_event);
-	last_button_event = k_uptime_get();
-	LOG_INF("Button %d %s (%d ms)\n", type, pressed ? "pressed" : "released", tx_data.duration_msec);
-	k_msgq_put(&ctrl_msgq, &tx_data, K_NO_WAIT);
+}
+
+void show_backlight_screen(struct ctx *ctx, struct display_state *screen)
+{
+	snprintf(screen->lines[0], sizeof(screen->lines[0]), "Beleuchtung");
+	snprintf(screen->lines[1], sizeof(screen->lines[1]), " an%3d%%  aus%3d%%",
+		 ctx->settings.backlight_active, ctx->settings.backlight_idle);
+}
+
+void show_calibration_screen(struct ctx *ctx, struct display_state *screen)
+{
+	char *line2 = screen->lines[1];
+	enum button_type next;
+
+	snprintf(screen->lines[0], sizeof(screen->lines[0]), "Tasten kalibr.");
+
+	switch (buttons_calibration_state(ctx->buttons, &next)) {
+	case BUTTON_CAL_RUNNING:
+		if (next == BUTTON_NONE) {
+			snprintf(line2, sizeof(screen->lines[1]), " loslassen");
+		} else {
+			snprintf(line2, sizeof(screen->lines[1]), " Taste %s", BUTTON_STR[next]);
+		}
+		break;
+	case BUTTON_CAL_DONE:
+		snprintf(line2, sizeof(screen->lines[1]), " gespeichert");
+		break;
+	case BUTTON_CAL_FAILED:
+		snprintf(line2, sizeof(screen->lines[1]), " Fehler");
+		break;
+	default:
+		snprintf(line2, sizeof(screen->lines[1]), " Start mit Hoch");
+		break;
+	}
+}
+
+void ctrl_button_handler(void* dev, enum button_type type, bool pressed, uint8_t repeat,
+			 uint32_t cycles)
+{
+	struct ctrl_event_ring *r = &ctrl_events;
+	atomic_val_t head = atomic_get(&r->head);
+	struct ctrl_event *ev;
+
+	if ((head - atomic_get(&r->tail)) >= CTRL_EVENTS) {
+		atomic_inc(&r->overflows);
+		return;
+	}
+
+	ev = &r->items[head & (CTRL_EVENTS - 1)];
+	ev->button_index = type;
+	ev->button_pressed = pressed;
+	ev->repeat = repeat;
+	ev->cycles = cycles;
+	/* publishes the item, atomic_set() is a full barrier */
+	atomic_set(&r->head, head + 1);
+	k_sem_give(&r->sem);
+}
+
+/** Time since the press, from the sample timestamps
+ *
+ * The cycle counter wraps after about 23 s at 180 MHz, longer holds are
+ * taken from the uptime. So are presses across a clock profile switch,
+ * the counter rate changed in between.
+ */
+static void ctrl_event_duration(struct ctrl_event *ev)
+{
+	struct ctrl_event_ring *r = &ctrl_events;
+	uint32_t now = k_uptime_get_32();
+
+	if (ev->button_pressed && !ev->repeat) {
+		r->press_cycles = ev->cycles;
+		r->press_msec = now;
+		r->press_switches = power_profile_switches();
+		ev->duration_msec = 0;
+		return;
+	}
+
+	ev->duration_msec = k_cyc_to_ms_floor32(ev->cycles - r->press_cycles);
+	if ((r->press_switches != power_profile_switches()) ||
+	    ((now - r->press_msec) > (ev->duration_msec + MSEC_PER_SEC))) {
+		ev->duration_msec = now - r->press_msec;
+	}
+}
+
+static void ctrl_alarm_handler(void *user_data)
+{
+	struct ctrl_event_ring *r = user_data;
+
+	atomic_set(&r->alarm, 1);
+	k_sem_give(&r->sem);
+}
+
+static void ctrl_tick_handler(void *user_data)
+{
+	struct ctrl_event_ring *r = user_data;
+
+	atomic_set(&r->tick, 1);
+	k_sem_give(&r->sem);
+}
+
+/** Take the next event
+ *
+ * Returns -EAGAIN on a refresh tick or timeout like k_msgq_get() and
+ * -EINTR when the RTC alarm went off.
+ */
+static int ctrl_event_get(struct ctrl_event *ev, k_timeout_t timeout)
+{
+	struct ctrl_event_ring *r = &ctrl_events;
+	atomic_val_t tail;
+
+	for (;;) {
+		tail = atomic_get(&r->tail);
+		if (tail != atomic_get(&r->head)) {
+			break;
+		}
+		if (atomic_clear(&r->alarm)) {
+			return -EINTR;
+		}
+		if (atomic_clear(&r->tick)) {
+			return -EAGAIN;
+		}
+		if (k_sem_take(&r->sem, timeout)) {
+			return -EAGAIN;
+		}
+	}
+
+	*ev = r->items[tail & (CTRL_EVENTS - 1)];
+	atomic_set(&r->tail, tail + 1);
+
+	ctrl_event_duration(ev);
+	LOG_INF("Button %d %s (%d ms, repeat %d)", ev->button_index,
+		ev->button_pressed ? "pressed" : "released",
+		ev->duration_msec, ev->repeat);
+	return 0;
 }
 
 static void ctrl_reset_screen(void) {
-	void *lcd = ctrl_ctx.lcd;
-	lcd_backlight(lcd, false);
+	display_backlight(ctrl_ctx.display, ctrl_ctx.settings.backlight_idle);
+	buttons_set_active(ctrl_ctx.buttons, false);
+	ctrl_ctx.idle = true;
 	ctrl_ctx.cursor.col = 0;
 	ctrl_ctx.cursor.row = 0;
 	LOG_DBG("");
@@ -168,35 +582,94 @@ static void ctrl_reset_screen(void) {
 static void user_input_expiry_function(struct k_timer *timer_id)
 {
 	LOG_INF("Input timer expired");
+	buttons_calibrate(ctrl_ctx.buttons, false);
 	ctrl_reset_screen();
 	ctrl_ctx.input_mode = INPUT_MODE_VIEW;
+	/* back to the main screen */
+	ctrl_tick_handler(&ctrl_events);
 }
 
-static enum op_mode calc_new_mode(struct ctrl_settings* settings, struct tm* now)
+static enum op_mode calc_new_mode(struct tm* now)
 {
+	enum schedule_mode mode = schedule_mode(ctrl_ctx.schedule, now);
+
 	LOG_DBG("");
-	if (now->tm_hour < settings->day_begin.hour) {
-		return OP_MODE_NIGHT;
+	if (ctrl_boost_remaining(now)) {
+		return ctrl_ctx.boost_mode;
 	}
-	if (now->tm_hour > settings->day_end.hour) {
-		return OP_MODE_NIGHT;
+
+	switch (ctrl_override_get(&ctrl_ctx.settings, now)) {
+	case CTRL_OVERRIDE_AWAY:
+		return OP_MODE_OFF;
+	case CTRL_OVERRIDE_ECO:
+		if (mode == SCHEDULE_DAY) {
+			mode = SCHEDULE_NIGHT;
+		}
+		break;
+	case CTRL_OVERRIDE_NONE:
+	default:
+		break;
 	}
-	if ((now->tm_hour == settings->day_begin.hour) &&
-	    (now->tm_min < settings->day_begin.minute)) {
+
+	switch (mode) {
+	case SCHEDULE_DAY:
+		return OP_MODE_DAY;
+	case SCHEDULE_FROST:
+		return OP_MODE_OFF;
+	case SCHEDULE_NIGHT:
+	default:
 		return OP_MODE_NIGHT;
 	}
-	if ((now->tm_hour == settings->day_end.hour) &&
-	    (now->tm_min > settings->day_end.minute)) {
-		return OP_MODE_NIGHT;
+}
+
+/** Wake the controller with the RTC alarm at the next mode change */
+static void ctrl_arm_alarm(struct tm* now)
+{
+	uint32_t secs = schedule_next_change(ctrl_ctx.schedule, now);
+	uint32_t boost = ctrl_boost_remaining(now);
+
+	if (boost) {
+		secs = MIN(secs, boost);
+	}
+	if (ctrl_override_pending(&ctrl_ctx.settings, now)) {
+		/* overrides begin and end at midnight */
+		secs = MIN(secs, 24 * 60 * 60 -
+			   (now->tm_hour * 60 * 60 + now->tm_min * 60 + now->tm_sec));
 	}
 
-	return OP_MODE_DAY;
+	LOG_INF("Next mode change in %u s", secs);
+	if (clock_rtc_alarm_set(ctrl_ctx.clock, secs, ctrl_alarm_handler, &ctrl_events)) {
+		ctrl_ctx.alarm_dirty = false;
+	}
+}
+
+/** Day or night for CONFIG_APP_BOOST_HOURS, OP_MODE_OFF ends the boost */
+static void ctrl_boost_start(enum op_mode mode)
+{
+	struct tm *now = clock_rtc_read(ctrl_ctx.clock);
+	struct persistent_ctrl_boost boost = {
+		.magic_no = PERSISTENT_BOOST_MAGIC,
+		.mode = mode,
+	};
+
+	if (mode != OP_MODE_OFF) {
+		boost.end = ctrl_minutes(now) + CONFIG_APP_BOOST_HOURS * 60;
+		LOG_INF("Boost %s for %d h", MODE_STR[mode], CONFIG_APP_BOOST_HOURS);
+	} else {
+		LOG_INF("Boost cancelled");
+	}
+
+	ctrl_ctx.boost_mode = mode;
+	ctrl_ctx.boost_end = boost.end;
+	if (!clock_rtc_reg_write(CLOCK_RTC_REG_BOOST, &boost, sizeof(boost))) {
+		LOG_ERR("Failed to persist boost in rtc regs");
+	}
+	/* the RTC alarm ends it */
+	ctrl_arm_alarm(now);
 }
 
 static void ctrl_set_cursor_pos(enum input_mode input_mode)
 {
-	void *lcd = ctrl_ctx.lcd;
-	
 	switch(input_mode) {
 	case INPUT_MODE_VIEW:
 	case INPUT_MODE_EDIT_CLOCK_HOUR:
@@ -209,7 +682,29 @@ static void ctrl_set_cursor_pos(enum input_mode input_mode)
 		break;	
 	case INPUT_MODE_EDIT_DAY:
 		ctrl_ctx.cursor.row = 0;
-		ctrl_ctx.cursor.col = 7;
+		ctrl_ctx.cursor.col = 9;
+		break;
+	case INPUT_MODE_EDIT_DATE:
+	case INPUT_MODE_EDIT_AWAY_BEGIN:
+	case INPUT_MODE_EDIT_ECO_UNTIL:
+		ctrl_ctx.cursor.row = 0;
+		ctrl_ctx.cursor.col = 9;
+		break;
+	case INPUT_MODE_EDIT_AWAY_END:
+		ctrl_ctx.cursor.row = 1;
+		ctrl_ctx.cursor.col = 9;
+		break;
+	case INPUT_MODE_EDIT_SCHEDULE_DAY:
+		ctrl_ctx.cursor.row = 0;
+		ctrl_ctx.cursor.col = 6;
+		break;
+	case INPUT_MODE_EDIT_SCHEDULE_INTERVAL:
+		ctrl_ctx.cursor.row = 0;
+		ctrl_ctx.cursor.col = 9;
+		break;
+	case INPUT_MODE_EDIT_SCHEDULE_MODE:
+		ctrl_ctx.cursor.row = 0;
+		ctrl_ctx.cursor.col = 11;
 		break;
 	case INPUT_MODE_EDIT_SCHEDULE_BEGIN_HOUR:
 		ctrl_ctx.cursor.row = 1;
@@ -227,12 +722,76 @@ static void ctrl_set_cursor_pos(enum input_mode input_mode)
 		ctrl_ctx.cursor.row = 1;
 		ctrl_ctx.cursor.col = 13;
 		break;
+	case INPUT_MODE_EDIT_BACKLIGHT_ACTIVE:
+		ctrl_ctx.cursor.row = 1;
+		ctrl_ctx.cursor.col = 5;
+		break;
+	case INPUT_MODE_EDIT_BACKLIGHT_IDLE:
+		ctrl_ctx.cursor.row = 1;
+		ctrl_ctx.cursor.col = 14;
+		break;
+	case INPUT_MODE_CALIBRATE_BUTTONS:
+		ctrl_ctx.cursor.row = 1;
+		ctrl_ctx.cursor.col = 0;
+		break;
 	case INPUT_MODE_LAST:
 	default:
 		ctrl_ctx.cursor.row = 0;
 		ctrl_ctx.cursor.col = 0;
 	}
-	lcd_set_cursor(lcd, ctrl_ctx.cursor.col, ctrl_ctx.cursor.row);
+}
+
+/** Redraw on the minute, every second on the clock pages and not at all
+ * while the backlight is off
+ */
+static void ctrl_refresh_arm(const struct tm *now)
+{
+	uint32_t secs = 60 - now->tm_sec;
+
+	if (ctrl_clock_page(ctrl_ctx.input_mode)) {
+		secs = 1;
+	} else if (ctrl_ctx.idle && !ctrl_ctx.settings.backlight_idle) {
+		/* alarms and buttons still redraw */
+		secs = 0;
+	}
+	clock_rtc_wakeup_set(ctrl_ctx.clock, secs, ctrl_tick_handler, &ctrl_events);
+}
+
+static void ctrl_redraw(struct tm *now)
+{
+	struct display_state screen;
+
+	if (ctrl_ctx.clock_edits) {
+		/* show the clock that is being edited */
+		now = &ctrl_ctx.edit_clock;
+	}
+
+	if (ctrl_ctx.input_mode == INPUT_MODE_CALIBRATE_BUTTONS) {
+		show_calibration_screen(&ctrl_ctx, &screen);
+	} else if (ctrl_ctx.input_mode >= INPUT_MODE_EDIT_BACKLIGHT_ACTIVE) {
+		show_backlight_screen(&ctrl_ctx, &screen);
+	} else if (ctrl_ctx.input_mode >= INPUT_MODE_EDIT_AWAY_BEGIN) {
+		show_date_screen(&ctrl_ctx, now, &screen);
+	} else if (ctrl_ctx.input_mode >= INPUT_MODE_EDIT_SCHEDULE_DAY) {
+		show_schedule_screen(&ctrl_ctx, &screen);
+	} else if (ctrl_ctx.input_mode == INPUT_MODE_EDIT_DATE) {
+		show_date_screen(&ctrl_ctx, now, &screen);
+	} else {
+		show_main_screen(&ctrl_ctx, now, &screen);
+	}
+
+	ctrl_ctx.cursor.blinking = ctrl_ctx.input_mode > INPUT_MODE_VIEW;
+	if (ctrl_ctx.cursor.blinking) {
+		ctrl_set_cursor_pos(ctrl_ctx.input_mode);
+	}
+	screen.cursor_col = ctrl_ctx.cursor.col;
+	screen.cursor_row = ctrl_ctx.cursor.row;
+	screen.blink = ctrl_ctx.cursor.blinking;
+
+	/* rendered by the display thread, bursts are collapsed */
+	display_post(ctrl_ctx.display, &screen);
+
+	ctrl_refresh_arm(now);
 }
 
 static void ctrl_change_cap_hour(uint8_t* current, int8_t delta)
@@ -250,6 +809,16 @@ static void ctrl_change_cap_hour(uint8_t* current, int8_t delta)
 static void ctrl_change_cap_minute(uint8_t* current, int8_t delta)
 {
 	int16_t new_value = *current + delta;
+	int16_t step = (delta < 0) ? -delta : delta;
+
+	/* big steps land on multiples of the step */
+	if ((step > 1) && (new_value > 0)) {
+		if (delta > 0) {
+			new_value -= new_value % step;
+		} else {
+			new_value += (step - new_value % step) % step;
+		}
+	}
 
 	if (new_value < 0) {
 		new_value = 0;
@@ -259,10 +828,325 @@ static void ctrl_change_cap_minute(uint8_t* current, int8_t delta)
 	*current = new_value;
 }
 
+/** Change a schedule slot, hours are 4 slots */
+static void ctrl_change_cap_slot(uint8_t* current, int8_t delta, uint8_t max)
+{
+	int16_t new_value = *current + delta;
+
+	if (new_value < 0) {
+		new_value = 0;
+	} else if (new_value > max) {
+		new_value = max;
+	}
+	*current = new_value;
+}
+
+static uint8_t ctrl_change_wrap(uint8_t current, int8_t delta, uint8_t count)
+{
+	return (current + count + delta % count) % count;
+}
+
+static uint8_t ctrl_days_in_month(const struct ctrl_date *date)
+{
+	static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+	/* every 4th year up to 2099 */
+	if ((date->month == 2) && ((date->year % 4) == 0)) {
+		return 29;
+	}
+	return days[date->month - 1];
+}
+
+/** Step by days, the year wraps within 00-99 like the two BCD digits of the RTC */
+static void ctrl_date_step(struct ctrl_date *date, int16_t delta)
+{
+	for (; delta > 0; delta--) {
+		if (++date->day > ctrl_days_in_month(date)) {
+			date->day = 1;
+			if (++date->month > 12) {
+				date->month = 1;
+				date->year = (date->year + 1) % 100;
+			}
+		}
+	}
+	for (; delta < 0; delta++) {
+		if (--date->day == 0) {
+			if (--date->month == 0) {
+				date->month = 12;
+				date->year = date->year ? date->year - 1 : 99;
+			}
+			date->day = ctrl_days_in_month(date);
+		}
+	}
+}
+
+/** Change an override date, it can't be in the past and is unset below today */
+static void ctrl_change_override_date(struct ctrl_date *date, int16_t delta)
+{
+	struct ctrl_date today = ctrl_date_of(clock_rtc_read(ctrl_ctx.clock));
+
+	if (!date->day) {
+		if (delta > 0) {
+			*date = today;
+			ctrl_date_step(date, delta - 1);
+		}
+		return;
+	}
+
+	ctrl_date_step(date, delta);
+	if (ctrl_date_key(date) < ctrl_date_key(&today)) {
+		date->day = 0;
+	}
+}
+
+static void ctrl_change_cap_percent(uint8_t* current, int8_t delta)
+{
+	int16_t new_value = *current + delta * BACKLIGHT_PERCENT_STEP;
+
+	if (new_value < 0) {
+		new_value = 0;
+	} else if (new_value > 100) {
+		new_value = 100;
+	}
+	*current = new_value;
+}
+
+/** Step size of a held UP/DOWN key
+ *
+ * Clock minutes speed up to 5 and 15, dates to weeks.
+ */
+static int8_t ctrl_repeat_step(enum input_mode input_mode, uint8_t repeat)
+{
+	if ((input_mode == INPUT_MODE_EDIT_DATE) ||
+	    ((input_mode >= INPUT_MODE_EDIT_AWAY_BEGIN) &&
+	     (input_mode <= INPUT_MODE_EDIT_ECO_UNTIL))) {
+		return (repeat < 12) ? 1 : 7;
+	}
+	if (input_mode != INPUT_MODE_EDIT_CLOCK_MINUTE) {
+		return 1;
+	}
+	if (repeat < 5) {
+		return 1;
+	}
+	if (repeat < 12) {
+		return 5;
+	}
+	return 15;
+}
+
+/** The clock is edited on a copy, so a held key writes the RTC once
+ *
+ * Only the fields named in edits are taken from the copy on commit, the
+ * rest comes from the running RTC.
+ */
+static struct tm* ctrl_edit_clock(uint8_t edits)
+{
+	if (!ctrl_ctx.clock_edits) {
+		ctrl_ctx.edit_clock = *clock_rtc_read(ctrl_ctx.clock);
+	}
+	ctrl_ctx.clock_edits |= edits;
+	return &ctrl_ctx.edit_clock;
+}
+
+static void ctrl_set_output_pins(void)
+{
+	LOG_INF("Setting output pins for mode %d", ctrl_ctx.mode);
+	
+	switch(ctrl_ctx.mode) {
+	case OP_MODE_DAY:
+		output_set(ctrl_ctx.output, OUTPUT_DAY);
+		break;
+	case OP_MODE_NIGHT:
+		output_set(ctrl_ctx.output, OUTPUT_NIGHT);
+		break;
+	case OP_MODE_OFF:
+	default:
+		output_set(ctrl_ctx.output, OUTPUT_OFF);
+		break;
+	}
+}
+
+static void ctrl_update_mode(struct tm *now)
+{
+	enum op_mode new_mode = calc_new_mode(now);
+
+	if (new_mode != ctrl_ctx.mode) {
+		LOG_INF("Switching modes (%s -> %s)", MODE_STR[ctrl_ctx.mode], MODE_STR[new_mode]);
+		ctrl_ctx.mode = new_mode;
+		ctrl_set_output_pins();
+	}
+}
+
+static void ctrl_settings_store(void)
+{
+	struct persistent_ctrl_settings settings = {
+		.magic_no = PERSISTENT_SETTINGS_MAGIC,
+		.version = PERSISTENT_SETTINGS_VERSION,
+		.settings = ctrl_ctx.settings
+	};
+
+	LOG_INF("Persisting settings");
+	if (!clock_rtc_reg_write(CLOCK_RTC_REG_SETTINGS, &settings, sizeof(settings))) {
+		LOG_ERR("Failed to persist settings in rtc regs");
+	}
+}
+
+/** Replace the weekly schedule by the day window of version 1 and 2
+ *
+ * The window included the end minute, both ends are rounded to the
+ * nearest slot.
+ */
+static void ctrl_schedule_from_window(const struct ctrl_time *begin,
+				      const struct ctrl_time *end)
+{
+	struct schedule *schedule = schedule_get(ctrl_ctx.schedule);
+	uint16_t begin_min = begin->hour * 60 + begin->minute;
+	uint16_t end_min = end->hour * 60 + end->minute + 1;
+
+	(void)memset(schedule, 0, sizeof(*schedule));
+	for (int day = 0; day < SCHEDULE_DAYS; day++) {
+		struct schedule_interval *iv = &schedule->days[day][0];
+
+		iv->begin = (begin_min + SCHEDULE_SLOT_MIN / 2) / SCHEDULE_SLOT_MIN;
+		iv->end = MIN((end_min + SCHEDULE_SLOT_MIN / 2) / SCHEDULE_SLOT_MIN,
+			      SCHEDULE_SLOTS_PER_DAY);
+		iv->mode = SCHEDULE_DAY;
+	}
+	schedule_commit(ctrl_ctx.schedule);
+
+	LOG_INF("Schedule from the day window %02u:%02u-%02u:%02u",
+		begin->hour, begin->minute, end->hour, end->minute);
+}
+
+/** Read the settings, older versions are converted and stored again
+ *
+ * Fields that an old version lacks keep their defaults. Needs the
+ * schedule, versions 1 and 2 kept the day window in the settings.
+ */
+static void ctrl_settings_load(void)
+{
+	union {
+		struct persistent_ctrl_settings cur;
+		struct {
+			uint32_t magic_no;
+			union {
+				struct ctrl_settings_v1 v1;
+				struct ctrl_settings_v2 v2;
+				struct ctrl_settings_v3 v3;
+				struct ctrl_settings v4;
+			} settings;
+		} __attribute__((packed)) old;
+	} read;
+	uint32_t magic;
+	uint8_t version;
+
+	if (!clock_rtc_reg_read(CLOCK_RTC_REG_SETTINGS, &read, sizeof(read))) {
+		LOG_ERR("Failed read settings from rtc regs");
+		return;
+	}
+
+	magic = read.cur.magic_no;
+	if (magic == PERSISTENT_SETTINGS_MAGIC) {
+		version = read.cur.version;
+		if (version == PERSISTENT_SETTINGS_VERSION) {
+			ctrl_ctx.settings = read.cur.settings;
+			return;
+		}
+		/* later versions are migrated here */
+		LOG_WRN("Settings version %u unknown, discarding", version);
+		return;
+	}
+
+	if ((magic < PERSISTENT_SETTINGS_MAGIC_OLD(1)) ||
+	    (magic > PERSISTENT_SETTINGS_MAGIC_OLD(4))) {
+		LOG_WRN("Settings from RTC wo magic, discarding");
+		return;
+	}
+	version = magic - PERSISTENT_SETTINGS_MAGIC_OLD(0);
+
+	switch (version) {
+	case 1:
+		ctrl_schedule_from_window(&read.old.settings.v1.day_begin,
+					  &read.old.settings.v1.day_end);
+		break;
+	case 2:
+		ctrl_schedule_from_window(&read.old.settings.v2.day_begin,
+					  &read.old.settings.v2.day_end);
+		ctrl_ctx.settings.backlight_active = read.old.settings.v2.backlight_active;
+		ctrl_ctx.settings.backlight_idle = read.old.settings.v2.backlight_idle;
+		break;
+	case 3:
+		ctrl_ctx.settings.backlight_active = read.old.settings.v3.backlight_active;
+		ctrl_ctx.settings.backlight_idle = read.old.settings.v3.backlight_idle;
+		break;
+	case 4:
+	default:
+		ctrl_ctx.settings = read.old.settings.v4;
+		break;
+	}
+
+	LOG_INF("Settings of version %u migrated", version);
+	ctrl_settings_store();
+}
+
+/** Write the edits to the RTC, the backup registers and the backup sram */
+static void ctrl_commit_edits(void)
+{
+	if (ctrl_ctx.clock_edits) {
+		const struct tm *edit = &ctrl_ctx.edit_clock;
+		/* the clock ran on while the key was held */
+		struct tm now_set = *clock_rtc_read(ctrl_ctx.clock);
+
+		if (ctrl_ctx.clock_edits & CTRL_EDIT_HOUR) {
+			now_set.tm_hour = edit->tm_hour;
+		}
+		if (ctrl_ctx.clock_edits & CTRL_EDIT_MINUTE) {
+			now_set.tm_min = edit->tm_min;
+		}
+		if (ctrl_ctx.clock_edits & CTRL_EDIT_WDAY) {
+			now_set.tm_wday = edit->tm_wday;
+		}
+		if (ctrl_ctx.clock_edits & CTRL_EDIT_DATE) {
+			now_set.tm_year = edit->tm_year;
+			now_set.tm_mon = edit->tm_mon;
+			now_set.tm_mday = edit->tm_mday;
+		}
+
+		LOG_INF("Setting clock");
+		clock_rtc_set(ctrl_ctx.clock, &now_set);
+		ctrl_ctx.clock_edits = 0;
+		ctrl_ctx.alarm_dirty = true;
+	}
+
+	if (ctrl_ctx.settings_dirty) {
+		ctrl_settings_store();
+		ctrl_ctx.settings_dirty = false;
+		ctrl_ctx.alarm_dirty = true;
+	}
+
+	if (ctrl_ctx.schedule_dirty) {
+		LOG_INF("Persisting schedule");
+		schedule_commit(ctrl_ctx.schedule);
+		ctrl_ctx.schedule_dirty = false;
+		ctrl_ctx.alarm_dirty = true;
+	}
+
+	if (ctrl_ctx.alarm_dirty) {
+		struct tm *now = clock_rtc_read(ctrl_ctx.clock);
+
+		/* the new clock, dates or schedule may change the mode now */
+		ctrl_update_mode(now);
+		ctrl_arm_alarm(now);
+	}
+}
+
 static void ctrl_change_current_item(int8_t delta)
 {
-	struct tm now_set;
-	struct tm* now;
+	struct tm* now_set;
+	struct ctrl_date date;
+	struct schedule_interval *iv =
+		&schedule_get(ctrl_ctx.schedule)->days[ctrl_ctx.schedule_day][ctrl_ctx.schedule_interval];
+	uint8_t minute;
 	int new_val;
 	
 	switch(ctrl_ctx.input_mode) {
@@ -271,168 +1155,210 @@ static void ctrl_change_current_item(int8_t delta)
 		return;
 	case INPUT_MODE_EDIT_CLOCK_HOUR:
 		LOG_INF("Change clock hour");
-		now = clock_rtc_read(ctrl_ctx.clock);
-		now_set = *now;
-		new_val = now_set.tm_hour + delta;
+		now_set = ctrl_edit_clock(CTRL_EDIT_HOUR);
+		new_val = now_set->tm_hour + delta;
 		if (new_val < 0) {
 			new_val = 0;
 		} else if (new_val > 23) {
 			new_val = 23;
 		}
-		now_set.tm_hour = new_val;
-		clock_rtc_set(ctrl_ctx.clock, &now_set);
+		now_set->tm_hour = new_val;
 		break;
 	case INPUT_MODE_EDIT_CLOCK_MINUTE:
-		LOG_INF("Change clock minute");
-		now = clock_rtc_read(ctrl_ctx.clock);
-		now_set = *now;
-		new_val = now_set.tm_min + delta;
-		if (new_val < 0) {
-			new_val = 0;
-		} else if (new_val > 59) {
-			new_val = 59;
-		}
-		now_set.tm_min = new_val;
-		clock_rtc_set(ctrl_ctx.clock, &now_set);
+		LOG_INF("Change clock minute by %d", delta);
+		now_set = ctrl_edit_clock(CTRL_EDIT_MINUTE);
+		minute = now_set->tm_min;
+		ctrl_change_cap_minute(&minute, delta);
+		now_set->tm_min = minute;
 		break;	
 	case INPUT_MODE_EDIT_DAY:
 		LOG_INF("Change clock day");
-		now = clock_rtc_read(ctrl_ctx.clock);
-		now_set = *now;
-		new_val = now_set.tm_wday + delta;
+		now_set = ctrl_edit_clock(CTRL_EDIT_WDAY);
+		new_val = now_set->tm_wday + delta;
 		if (new_val < 0) {
 			new_val = 6;
 		} else if (new_val > 6) {
 			new_val = 0;
 		}
-		now_set.tm_wday = new_val;
-		clock_rtc_set(ctrl_ctx.clock, &now_set);
+		now_set->tm_wday = new_val;
+		break;
+	case INPUT_MODE_EDIT_DATE:
+		LOG_INF("Change clock date by %d", delta);
+		now_set = ctrl_edit_clock(CTRL_EDIT_DATE | CTRL_EDIT_WDAY);
+		date = ctrl_date_of(now_set);
+		ctrl_date_step(&date, delta);
+		now_set->tm_year = date.year + 100;
+		now_set->tm_mon = date.month - 1;
+		now_set->tm_mday = date.day;
+		/* the RTC keeps the weekday separately */
+		now_set->tm_wday = ctrl_change_wrap(now_set->tm_wday, delta, 7);
+		break;
+	case INPUT_MODE_EDIT_SCHEDULE_DAY:
+		ctrl_ctx.schedule_day = ctrl_change_wrap(ctrl_ctx.schedule_day, delta,
+							 SCHEDULE_DAYS);
+		return;
+	case INPUT_MODE_EDIT_SCHEDULE_INTERVAL:
+		ctrl_ctx.schedule_interval = ctrl_change_wrap(ctrl_ctx.schedule_interval, delta,
+							      SCHEDULE_INTERVALS);
+		return;
+	case INPUT_MODE_EDIT_SCHEDULE_MODE:
+		LOG_INF("Change sched mode by %d", delta);
+		iv->mode = ctrl_change_wrap(iv->mode, delta, SCHEDULE_MODES);
 		break;
 	case INPUT_MODE_EDIT_SCHEDULE_BEGIN_HOUR:
 		LOG_INF("Change sched begin hour by %d", delta);
-		ctrl_change_cap_hour(&ctrl_ctx.settings.day_begin.hour, delta);
+		ctrl_change_cap_slot(&iv->begin, delta * 60 / SCHEDULE_SLOT_MIN,
+				     SCHEDULE_SLOTS_PER_DAY - 1);
 		break;
 	case INPUT_MODE_EDIT_SCHEDULE_BEGIN_MINUTE:
 		LOG_INF("Change sched begin minute by %d", delta);
-		ctrl_change_cap_minute(&ctrl_ctx.settings.day_begin.minute, delta);
+		ctrl_change_cap_slot(&iv->begin, delta, SCHEDULE_SLOTS_PER_DAY - 1);
 		break;
 	case INPUT_MODE_EDIT_SCHEDULE_END_HOUR:
 		LOG_INF("Change sched end hour by %d", delta);
-		ctrl_change_cap_hour(&ctrl_ctx.settings.day_end.hour, delta);
+		ctrl_change_cap_slot(&iv->end, delta * 60 / SCHEDULE_SLOT_MIN,
+				     SCHEDULE_SLOTS_PER_DAY);
 		break;
 	case INPUT_MODE_EDIT_SCHEDULE_END_MINUTE:
 		LOG_INF("Change sched end minute by %d", delta);
-		ctrl_change_cap_minute(&ctrl_ctx.settings.day_end.minute, delta);
+		ctrl_change_cap_slot(&iv->end, delta, SCHEDULE_SLOTS_PER_DAY);
+		break;
+	case INPUT_MODE_EDIT_AWAY_BEGIN:
+		LOG_INF("Change away begin by %d", delta);
+		ctrl_change_override_date(&ctrl_ctx.settings.away_begin, delta);
+		/* the end follows, a begin without end is never active */
+		if (ctrl_date_key(&ctrl_ctx.settings.away_end) <
+		    ctrl_date_key(&ctrl_ctx.settings.away_begin)) {
+			ctrl_ctx.settings.away_end = ctrl_ctx.settings.away_begin;
+		}
+		break;
+	case INPUT_MODE_EDIT_AWAY_END:
+		LOG_INF("Change away end by %d", delta);
+		ctrl_change_override_date(&ctrl_ctx.settings.away_end, delta);
+		if (ctrl_date_key(&ctrl_ctx.settings.away_end) <
+		    ctrl_date_key(&ctrl_ctx.settings.away_begin)) {
+			ctrl_ctx.settings.away_end = ctrl_ctx.settings.away_begin;
+		}
+		break;
+	case INPUT_MODE_EDIT_ECO_UNTIL:
+		LOG_INF("Change eco until by %d", delta);
+		ctrl_change_override_date(&ctrl_ctx.settings.eco_until, delta);
+		break;
+	case INPUT_MODE_EDIT_BACKLIGHT_ACTIVE:
+		LOG_INF("Change backlight active by %d", delta);
+		ctrl_change_cap_percent(&ctrl_ctx.settings.backlight_active, delta);
+		display_backlight(ctrl_ctx.display, ctrl_ctx.settings.backlight_active);
+		break;
+	case INPUT_MODE_EDIT_BACKLIGHT_IDLE:
+		LOG_INF("Change backlight idle by %d", delta);
+		ctrl_change_cap_percent(&ctrl_ctx.settings.backlight_idle, delta);
+		/* preview the idle brightness until the next key press */
+		display_backlight(ctrl_ctx.display, ctrl_ctx.settings.backlight_idle);
 		break;
+	case INPUT_MODE_CALIBRATE_BUTTONS:
+		if (delta > 0) {
+			LOG_INF("Calibrate buttons");
+			buttons_calibrate(ctrl_ctx.buttons, true);
+		}
+		return;
 	case INPUT_MODE_LAST:
 	default:
 		break;
 	}
 
-	if ((ctrl_ctx.input_mode == INPUT_MODE_EDIT_SCHEDULE_BEGIN_HOUR) ||
-	    (ctrl_ctx.input_mode == INPUT_MODE_EDIT_SCHEDULE_BEGIN_MINUTE) ||
-	    (ctrl_ctx.input_mode == INPUT_MODE_EDIT_SCHEDULE_END_HOUR) ||
-	    (ctrl_ctx.input_mode == INPUT_MODE_EDIT_SCHEDULE_END_MINUTE))
-	{
-		struct persistent_ctrl_settings settings = {
-			.magic_no = PERSISTENT_SETTINGS_MAGIC,
-			.settings = ctrl_ctx.settings
-		};
-		if (!clock_rtc_reg_write(&settings, sizeof(settings))) {
-			LOG_ERR("Failed to persist settings in rtc regs");
-		}
+	if (ctrl_ctx.input_mode >= INPUT_MODE_EDIT_AWAY_BEGIN) {
+		ctrl_ctx.settings_dirty = true;
+	} else if (ctrl_ctx.input_mode >= INPUT_MODE_EDIT_SCHEDULE_DAY) {
+		ctrl_ctx.schedule_dirty = true;
 	}
 }
 
-static void ctrl_set_output_pins(void)
+/** Short press of select in view mode */
+static void ctrl_dump_stats(void)
 {
-	LOG_INF("Setting output pins for mode %d", ctrl_ctx.mode);
-	
-	switch(ctrl_ctx.mode) {
-	case OP_MODE_DAY:
-		output_set(ctrl_ctx.output, OUTPUT_DAY);
-		break;
-	case OP_MODE_NIGHT:
-		output_set(ctrl_ctx.output, OUTPUT_NIGHT);
-		break;
-	case OP_MODE_OFF:
-	default:
-		output_set(ctrl_ctx.output, OUTPUT_OFF);
-		break;
-	}
+	LOG_INF("Statistics, uptime %u s", k_uptime_get_32() / MSEC_PER_SEC);
+	display_stats_dump(ctrl_ctx.display);
+	buttons_stats_dump(ctrl_ctx.buttons);
+	power_stats_dump();
+	power_profile_stats_dump();
+	LOG_INF("Button events dropped: %d", (int)atomic_get(&ctrl_events.overflows));
+	LOG_INF("Wake-ups: %u buttons, %u alarms, %u refresh ticks", ctrl_ctx.wake_button,
+		ctrl_ctx.wake_alarm, ctrl_ctx.wake_tick);
 }
 
 static void ctrl_func(void *ctx, void *u2, void *u3)
 {
-	void *lcd = ctrl_ctx.lcd;
+	void *display = ctrl_ctx.display;
 	void *clock = ctrl_ctx.clock;
 	//void *buttons = ctrl_ctx.buttons;
-	struct msgq_item_t event;
+	struct ctrl_event event;
 	int res;
-	struct tm *now;
-
-	struct tm now_set = {
-		.tm_sec = 30,
-		.tm_min = 23,
-		.tm_hour = 19,
-		.tm_mday = 4,
-		.tm_wday = 6,
-		.tm_mon = 6,
-		.tm_year = 120
-	};
-
-
-	//enable backlight
-	lcd_backlight(lcd, true);
 
-	/* Clear display */
-	lcd_clear(lcd);
-	/*k_msleep(MSEC_PER_SEC * 3U);*/
-	lcd_set_cursor(lcd, 0, 0);
-	lcd_string(lcd, "Heizungs-Ctrl");
-	lcd_set_cursor(lcd, 0, 1);
-	lcd_string(lcd, "V 2020-07-04");
-	
-	now = clock_rtc_read(clock);
-	if (now->tm_year < 120) {
-		//if rtc returns date before 2020, set clock to some hardcoded default
-		clock_rtc_set(clock, &now_set);
-	}
+	//enable backlight, the splash is shown by the display thread
+	display_backlight(display, ctrl_ctx.settings.backlight_active);
 
-	k_msleep(MSEC_PER_SEC * 3U);
 	ctrl_ctx.cursor.row = 0;
 	ctrl_ctx.cursor.col = 0;
 
 	k_timer_start(&user_input_timer, K_SECONDS(30), K_NO_WAIT);
 
-	/* to unblock to init lcd and state */
-	static struct msgq_item_t tx_data = {
-		.button_index = BUTTON_NONE,
-		.button_pressed = false,
-	};
-	k_msgq_put(&ctrl_msgq, &tx_data, K_NO_WAIT);
-	
+	ctrl_arm_alarm(clock_rtc_read(clock));
+
+	/* first screen after the splash */
+	ctrl_redraw(clock_rtc_read(clock));
+
 	while (1) {
-		res = k_msgq_get(&ctrl_msgq, &event, K_MSEC(15000));
+		res = ctrl_event_get(&event, K_FOREVER);
+
+		/* full speed only while somebody uses the keys */
+		if (!res) {
+			power_profile_set(POWER_PROFILE_BOOST);
+		} else if (ctrl_ctx.idle) {
+			power_profile_set(POWER_PROFILE_LOW);
+		}
 
 		struct tm* now = clock_rtc_read(clock);
-		enum op_mode new_mode = calc_new_mode(&ctrl_ctx.settings, now);
-		if (new_mode != ctrl_ctx.mode) {
-			LOG_INF("Switching modes (%s -> %s)", MODE_STR[ctrl_ctx.mode], MODE_STR[new_mode]);
-			ctrl_ctx.mode = new_mode;
-			ctrl_set_output_pins();
+		ctrl_update_mode(now);
+
+		if (res == -EINTR) {
+			ctrl_ctx.wake_alarm++;
+			ctrl_ctx.alarm_dirty = true;
+		} else if (res) {
+			ctrl_ctx.wake_tick++;
+		} else {
+			ctrl_ctx.wake_button++;
 		}
-		
+		if (ctrl_ctx.alarm_dirty) {
+			ctrl_arm_alarm(now);
+		}
+
 		if (res) {
-			/* Clear display */
-			lcd_clear(lcd);
-			show_main_screen(&ctrl_ctx, now);
+			ctrl_redraw(now);
+			continue;
+		}
+
+		if (event.button_pressed && event.repeat) {
+			/* only a held UP/DOWN changes values, committed on release */
+			if ((ctrl_ctx.input_mode > INPUT_MODE_VIEW) &&
+			    (ctrl_ctx.input_mode != INPUT_MODE_CALIBRATE_BUTTONS) &&
+			    ((event.button_index == BUTTON_UP) ||
+			     (event.button_index == BUTTON_DOWN))) {
+				int8_t step = ctrl_repeat_step(ctrl_ctx.input_mode, event.repeat);
+
+				ctrl_change_current_item(event.button_index == BUTTON_UP ?
+							 step : -step);
+				ctrl_ctx.repeated = true;
+				k_timer_start(&user_input_timer, K_SECONDS(30), K_NO_WAIT);
+				ctrl_redraw(now);
+			}
 			continue;
 		}
 		
 		if (!event.button_pressed) {
 			LOG_INF("Restarting input timer");
-			lcd_backlight(lcd, true);
+			display_backlight(display, ctrl_ctx.settings.backlight_active);
+			buttons_set_active(ctrl_ctx.buttons, true);
+			ctrl_ctx.idle = false;
 			k_timer_start(&user_input_timer, K_SECONDS(30), K_NO_WAIT);
 			// handle input
 			switch (event.button_index) {
@@ -444,6 +1370,8 @@ static void ctrl_func(void *ctx, void *u2, void *u3)
 				} else if (ctrl_ctx.input_mode != INPUT_MODE_VIEW) {
 					LOG_INF("Change into view mode");
 					ctrl_ctx.input_mode = INPUT_MODE_VIEW;
+				} else {
+					ctrl_dump_stats();
 				}
 				break;
 			case BUTTON_RIGHT:
@@ -464,88 +1392,142 @@ static void ctrl_func(void *ctx, void *u2, void *u3)
 				break;
 			case BUTTON_UP:
 				if (ctrl_ctx.input_mode > INPUT_MODE_VIEW) {
-					//change current setting
-					ctrl_change_current_item(1);
+					//change current setting, unless it was held
+					if (!ctrl_ctx.repeated) {
+						ctrl_change_current_item(1);
+					}
+					ctrl_commit_edits();
+				} else if (event.duration_msec >= 3000) {
+					ctrl_boost_start(OP_MODE_DAY);
+					ctrl_update_mode(clock_rtc_read(clock));
+				} else if (ctrl_boost_remaining(clock_rtc_read(clock))) {
+					ctrl_boost_start(OP_MODE_OFF);
+					ctrl_update_mode(clock_rtc_read(clock));
 				}
 				break;
 			case BUTTON_DOWN:
 				if (ctrl_ctx.input_mode > INPUT_MODE_VIEW) {
-					//change current setting
-					ctrl_change_current_item(-1);
+					//change current setting, unless it was held
+					if (!ctrl_ctx.repeated) {
+						ctrl_change_current_item(-1);
+					}
+					ctrl_commit_edits();
+				} else if (event.duration_msec >= 3000) {
+					ctrl_boost_start(OP_MODE_NIGHT);
+					ctrl_update_mode(clock_rtc_read(clock));
+				} else if (ctrl_boost_remaining(clock_rtc_read(clock))) {
+					ctrl_boost_start(OP_MODE_OFF);
+					ctrl_update_mode(clock_rtc_read(clock));
 				}
 				break;
 				
 			default:
-				lcd_blink_off(lcd);				
+				break;
 			}
+			ctrl_ctx.repeated = false;
 		}
-		LOG_INF("1 - %d", ctrl_ctx.input_mode);
+		LOG_DBG("1 - %d", ctrl_ctx.input_mode);
 		if (!event.button_pressed) {
-			/* Clear display */
-			lcd_clear(lcd);
 			now = clock_rtc_read(clock);
-			show_main_screen(&ctrl_ctx, now);
-			LOG_INF("3 - %d", ctrl_ctx.input_mode);
+			ctrl_redraw(now);
+			LOG_DBG("3 - %d", ctrl_ctx.input_mode);
 					
 		}
-		LOG_INF("2 - %d", ctrl_ctx.input_mode);
-
-		if (ctrl_ctx.input_mode > INPUT_MODE_VIEW) {
-			ctrl_set_cursor_pos(ctrl_ctx.input_mode);
-			lcd_blink_on(lcd);
-		} else {
-			lcd_blink_off(lcd);
-		}
-		LOG_INF("4 - %d", ctrl_ctx.input_mode);
+		LOG_DBG("2 - %d", ctrl_ctx.input_mode);
+		LOG_DBG("4 - %d", ctrl_ctx.input_mode);
 				
 	}
 }
 
-void* ctrl_init(void)
+/** Drive the output for the current time before anything else */
+static bool ctrl_early_init(void)
 {
-	struct persistent_ctrl_settings read_settings;
-	ctrl_ctx.input_mode = INPUT_MODE_VIEW;
-	ctrl_ctx.settings.day_begin.hour = 6;
-	ctrl_ctx.settings.day_begin.minute = 0;
-	ctrl_ctx.settings.day_end.hour = 22;
-	ctrl_ctx.settings.day_end.minute = 0;
-	ctrl_ctx.mode = OP_MODE_OFF;
-	ctrl_ctx.lcd = lcd_init();
-	
-	if (!ctrl_ctx.lcd) {
-		LOG_ERR("Failed to init lcd\n");
-		return NULL;
-	}
-
-	ctrl_ctx.buttons = buttons_init(ctrl_button_handler);
+	struct persistent_ctrl_boost read_boost;
+	struct tm *now;
 
-	if (!ctrl_ctx.buttons) {
-		LOG_ERR("Failed to init button driver\n");
-		return NULL;
-	}
+	struct tm now_set = {
+		.tm_sec = 30,
+		.tm_min = 23,
+		.tm_hour = 19,
+		.tm_mday = 4,
+		.tm_wday = 6,
+		.tm_mon = 6,
+		.tm_year = 120
+	};
 
 	ctrl_ctx.output = output_init();
 
 	if (!ctrl_ctx.output) {
-		LOG_ERR("Failed to init output driver\n");
-		return NULL;
+		LOG_ERR("Failed to init output driver");
+		return false;
 	}
 
 	ctrl_ctx.clock = clock_init();
 
 	if (!ctrl_ctx.clock) {
-		LOG_ERR("Failed to init clock driver\n");
+		LOG_ERR("Failed to init clock driver");
+		return false;
+	}
+
+	/* needs the backup sram enabled by the clock */
+	ctrl_ctx.schedule = schedule_init();
+
+	ctrl_settings_load();
+
+	if (!clock_rtc_reg_read(CLOCK_RTC_REG_BOOST, &read_boost, sizeof(read_boost))) {
+		LOG_ERR("Failed read boost from rtc regs");
+	} else if ((read_boost.magic_no == PERSISTENT_BOOST_MAGIC) &&
+		   ((read_boost.mode == OP_MODE_DAY) || (read_boost.mode == OP_MODE_NIGHT))) {
+		/* expired boosts end in the past and are ignored */
+		ctrl_ctx.boost_mode = read_boost.mode;
+		ctrl_ctx.boost_end = read_boost.end;
+	}
+
+	now = clock_rtc_read(ctrl_ctx.clock);
+	if (now->tm_year < 120) {
+		//if rtc returns date before 2020, set clock to some hardcoded default
+		clock_rtc_set(ctrl_ctx.clock, &now_set);
+		now = clock_rtc_read(ctrl_ctx.clock);
+	}
+
+	ctrl_ctx.mode = calc_new_mode(now);
+	ctrl_set_output_pins();
+	LOG_INF("Output valid %u us after boot",
+		k_cyc_to_us_floor32(k_cycle_get_32()));
+
+	return true;
+}
+
+void* ctrl_init(void)
+{
+	static const struct display_state splash = {
+		.lines = {"Heizungs-Ctrl", "V 2020-07-04"},
+	};
+
+	ctrl_ctx.input_mode = INPUT_MODE_VIEW;
+	ctrl_ctx.schedule_day = 1;
+	ctrl_ctx.settings.backlight_active = CONFIG_APP_BACKLIGHT_ACTIVE_PERCENT;
+	ctrl_ctx.settings.backlight_idle = CONFIG_APP_BACKLIGHT_IDLE_PERCENT;
+	ctrl_ctx.mode = OP_MODE_OFF;
+
+	if (!ctrl_early_init()) {
 		return NULL;
 	}
 
-	if (!clock_rtc_reg_read(&read_settings, sizeof(read_settings))) {
-		LOG_ERR("Failed read settings from rtc regs\n");
-	} else {
-		if (read_settings.magic_no != PERSISTENT_SETTINGS_MAGIC) {
-			LOG_WRN("Settings from RTC wo magic, discarding");
-		} else {
-			ctrl_ctx.settings = read_settings.settings;
-		}
+	/* lcd init and splash run in the display thread */
+	ctrl_ctx.display = display_init(&splash);
+
+	if (!ctrl_ctx.display) {
+		LOG_ERR("Failed to init display");
+		return NULL;
+	}
+
+	k_sem_init(&ctrl_events.sem, 0, 1);
+	ctrl_ctx.buttons = buttons_init(ctrl_button_handler);
+
+	if (!ctrl_ctx.buttons) {
+		LOG_ERR("Failed to init button driver");
+		return NULL;
 	}
 
 	k_thread_create(&ctrl_thread_data, ctrl_stack_area,
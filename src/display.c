@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(disp, CONFIG_APP_LCD_LOG_LEVEL);
+
+#include "display.h"
+
+#include "backlight.h"
+#include "lcd.h"
+
+#define DISPLAY_STACK_SIZE 1024
+#define DISPLAY_THREAD_PRIORITY 7
+#define DISPLAY_SPLASH_MSEC 3000
+
+struct display_ctx {
+	void *lcd;
+	void *backlight_dev;
+	const struct display_state *splash;
+	struct k_spinlock lock;
+	/* latest posted state, protected by lock */
+	struct display_state pending;
+	uint8_t backlight;
+	uint32_t posted;
+	uint32_t rendered;
+};
+
+static struct display_ctx display_ctx;
+
+K_THREAD_STACK_DEFINE(display_stack_area, DISPLAY_STACK_SIZE);
+static struct k_work_q display_work_q;
+
+static void display_render(struct k_work *work);
+static void display_start(struct k_work *work);
+
+K_WORK_DEFINE(display_render_work, display_render);
+K_WORK_DEFINE(display_start_work, display_start);
+
+static void display_show(struct display_ctx *ctx, const struct display_state *state)
+{
+	lcd_begin(ctx->lcd);
+	lcd_clear(ctx->lcd);
+	for (uint8_t row = 0; row < DISPLAY_ROWS; row++) {
+		lcd_set_cursor(ctx->lcd, 0, row);
+		lcd_string(ctx->lcd, state->lines[row]);
+	}
+
+	lcd_set_cursor(ctx->lcd, state->cursor_col, state->cursor_row);
+	if (state->blink) {
+		lcd_blink_on(ctx->lcd);
+	} else {
+		lcd_blink_off(ctx->lcd);
+	}
+
+	/* only the changed characters and control bits are sent */
+	lcd_commit(ctx->lcd);
+}
+
+static void display_set_backlight(struct display_ctx *ctx, uint8_t percent)
+{
+#ifdef CONFIG_APP_BACKLIGHT_PWM
+	static uint8_t current;
+
+	if (!ctx->backlight_dev) {
+		return;
+	}
+
+	/* brighter at once on a key press, fade out when getting darker */
+	backlight_set(ctx->backlight_dev, percent,
+		      percent < current ? CONFIG_APP_BACKLIGHT_FADE_MSEC : 0);
+	current = percent;
+#else
+	lcd_backlight(ctx->lcd, percent > 0);
+#endif
+}
+
+/** Init the lcd and show the splash, posted states wait until it is done */
+static void display_start(struct k_work *work)
+{
+	struct display_ctx *ctx = &display_ctx;
+
+	ctx->lcd = lcd_init();
+	if (!ctx->lcd) {
+		LOG_ERR("Failed to init lcd");
+		return;
+	}
+
+	if (ctx->splash) {
+		display_show(ctx, ctx->splash);
+		k_msleep(DISPLAY_SPLASH_MSEC);
+	}
+}
+
+static void display_render(struct k_work *work)
+{
+	struct display_ctx *ctx = &display_ctx;
+	struct display_state state;
+	uint32_t start = k_cycle_get_32();
+	k_spinlock_key_t key;
+	uint32_t posted, rendered;
+	uint8_t backlight;
+
+	if (!ctx->lcd) {
+		return;
+	}
+
+	key = k_spin_lock(&ctx->lock);
+	state = ctx->pending;
+	backlight = ctx->backlight;
+	posted = ctx->posted;
+	rendered = ++ctx->rendered;
+	k_spin_unlock(&ctx->lock, key);
+
+	display_set_backlight(ctx, backlight);
+
+	display_show(ctx, &state);
+
+	LOG_INF("Redraw took %u us (%u posted, %u rendered)",
+		k_cyc_to_us_floor32(k_cycle_get_32() - start),
+		posted, rendered);
+}
+
+void display_post(void *dev, const struct display_state *state)
+{
+	struct display_ctx *ctx = dev;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&ctx->lock);
+	ctx->pending = *state;
+	ctx->posted++;
+	k_spin_unlock(&ctx->lock, key);
+
+	/* no-op if the render is still queued, it picks up this state */
+	k_work_submit_to_queue(&display_work_q, &display_render_work);
+}
+
+void display_backlight(void *dev, uint8_t percent)
+{
+	struct display_ctx *ctx = dev;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&ctx->lock);
+	ctx->backlight = percent;
+	k_spin_unlock(&ctx->lock, key);
+
+	k_work_submit_to_queue(&display_work_q, &display_render_work);
+}
+
+void display_stats_dump(void *dev)
+{
+	struct display_ctx *ctx = dev;
+	k_spinlock_key_t key;
+	uint32_t posted, rendered;
+
+	key = k_spin_lock(&ctx->lock);
+	posted = ctx->posted;
+	rendered = ctx->rendered;
+	k_spin_unlock(&ctx->lock, key);
+
+	LOG_INF("Display: %u states posted, %u rendered", posted, rendered);
+	if (ctx->lcd) {
+		lcd_stats_dump(ctx->lcd);
+	}
+}
+
+void *display_init(const struct display_state *splash)
+{
+	struct display_ctx *ctx = &display_ctx;
+
+	ctx->splash = splash;
+
+#ifdef CONFIG_APP_BACKLIGHT_PWM
+	ctx->backlight_dev = backlight_init();
+	if (!ctx->backlight_dev) {
+		LOG_ERR("Failed to init backlight");
+	}
+#endif
+
+	k_work_q_start(&display_work_q, display_stack_area,
+		       K_THREAD_STACK_SIZEOF(display_stack_area),
+		       DISPLAY_THREAD_PRIORITY);
+	k_work_submit_to_queue(&display_work_q, &display_start_work);
+
+	return ctx;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_DISPLAY_H
+#define APP_DISPLAY_H
+
+#include <zephyr.h>
+
+#define DISPLAY_COLS 16
+#define DISPLAY_ROWS 2
+
+/** Snapshot of everything that is shown on the lcd */
+struct display_state {
+	char lines[DISPLAY_ROWS][DISPLAY_COLS + 1];
+	uint8_t cursor_col;
+	uint8_t cursor_row;
+	bool blink;
+};
+
+/** Start the display thread, it inits the lcd and shows the splash */
+void *display_init(const struct display_state *splash);
+
+/** Render the state in the background, older pending states are dropped */
+void display_post(void *dev, const struct display_state *state);
+
+/** Set the backlight brightness in percent, without pwm it is on or off */
+void display_backlight(void *dev, uint8_t percent);
+
+/** Log the render and lcd bus statistics */
+void display_stats_dump(void *dev);
+
+#endif /* APP_DISPLAY_H */
@@ -4,74 +4,22 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <logging/log.h>
+LOG_MODULE_REGISTER(lcd, CONFIG_APP_LCD_LOG_LEVEL);
+
 #include "lcd.h"
+#include "lcd_bus.h"
+#include "power.h"
 
-#include <sys/printk.h>
-#include <drivers/gpio.h>
 #include <string.h>
 
-#if defined(CONFIG_BOARD_NUCLEO_F429ZI)
-/*	https://wiki.dfrobot.com/Arduino_LCD_KeyPad_Shield__SKU__DFR0009_ */
-/* Define GPIO OUT to LCD */
-#define GPIO_PIN_D4		14	/* DB4 PF14 */
-#define GPIO_PORT_D4	        "GPIOF"
-#define GPIO_PIN_D5		11	/* DB5 PE11 */
-#define GPIO_PORT_D5	        "GPIOE"
-#define GPIO_PIN_D6		9	/* DB6 PE9 */
-#define GPIO_PORT_D6	        "GPIOE"
-#define GPIO_PIN_D7		13	/* DB7 PF13 */
-#define GPIO_PORT_D7	        "GPIOF"
-#define GPIO_PIN_RS		12	/* D8 RS PF12 */
-#define GPIO_PORT_RS	        "GPIOF"
-#define GPIO_PIN_E		15	/* D9 Enable PD15 */
-#define GPIO_PORT_E	        "GPIOD"
-#define GPIO_PIN_BL       14               /* D10 backlight control PD14 */
-#define GPIO_PORT_BL	        "GPIOD"
-#elif defined(CONFIG_BOARD_NUCLEO_F446RE)
-#define GPIO_PIN_D4		5	/* DB4 PB5 */
-#define GPIO_PORT_D4	        "GPIOB"
-#define GPIO_PIN_D5		4	/* DB5 PB4 */
-#define GPIO_PORT_D5	        "GPIOB"
-#define GPIO_PIN_D6		10	/* DB6 PB10 */
-#define GPIO_PORT_D6	        "GPIOB"
-#define GPIO_PIN_D7		8	/* DB7 PA8 */
-#define GPIO_PORT_D7	        "GPIOA"
-#define GPIO_PIN_RS		9	/* D8 RS PA9 */
-#define GPIO_PORT_RS	        "GPIOA"
-#define GPIO_PIN_E		7	/* D9 Enable PC7 */
-#define GPIO_PORT_E	        "GPIOC"
-#define GPIO_PIN_BL       6               /* D10 backlight control PB6 */
-#define GPIO_PORT_BL	        "GPIOB"
-#else
-#error "unsupported board"
+#ifdef CONFIG_APP_LCD_TIMING_TIMER_ISR
+#include <drivers/clock_control.h>
+#include <drivers/clock_control/stm32_clock_control.h>
+#include <soc.h>
+#include <stm32f4xx_ll_tim.h>
 #endif
 
-struct gpio_info {
-	const char* port;
-	const uint8_t index;
-	struct device *dev;
-};
-
-enum gpio_index {
-	GPIO_IDX_D4 = 0,
-	GPIO_IDX_D5,
-	GPIO_IDX_D6,
-	GPIO_IDX_D7,
-	GPIO_IDX_RS,
-	GPIO_IDX_E,
-	GPIO_IDX_BL,
-};
-
-static struct gpio_info global_gpios[] = {
-	{GPIO_PORT_D4, GPIO_PIN_D4, NULL},
-	{GPIO_PORT_D5, GPIO_PIN_D5, NULL},
-	{GPIO_PORT_D6, GPIO_PIN_D6, NULL},
-	{GPIO_PORT_D7, GPIO_PIN_D7, NULL},
-	{GPIO_PORT_RS, GPIO_PIN_RS, NULL},
-	{GPIO_PORT_E, GPIO_PIN_E, NULL},
-	{GPIO_PORT_BL, GPIO_PIN_BL, NULL},
-};
-
 /* Commands */
 #define LCD_CLEAR_DISPLAY		0x01
 #define LCD_RETURN_HOME			0x02
@@ -112,18 +60,33 @@ static struct gpio_info global_gpios[] = {
 
 /* Define some device constants */
 #define LCD_WIDTH			20	/* Max char per line */
-#define HIGH				1
-#define LOW				0
-/* in millisecond */
-#define	ENABLE_DELAY			1/*10*/
+#define LCD_COLS			16
+#define LCD_ROWS			2
+#define LCD_ADDR_UNKNOWN		0xFF
+#define LCD_STATE_UNKNOWN		0xFF
+
+#if defined(CONFIG_APP_LCD_BUS_GPIO)
+#define LCD_BUS				lcd_bus_gpio
+#elif defined(CONFIG_APP_LCD_BUS_PCF8574)
+#define LCD_BUS				lcd_bus_pcf8574
+#elif defined(CONFIG_APP_LCD_BUS_MODEL)
+#define LCD_BUS				lcd_bus_model
+#else
+#error "no lcd bus selected"
+#endif
+
 
 
 struct pi_lcd_data {
 	uint8_t	disp_func;	/* Display Function */
 	uint8_t	disp_cntl;	/* Display Control */
 	uint8_t disp_mode;	/* Display Mode */
+	uint8_t	hw_cntl;	/* Display Control sent to the controller */
+	uint8_t hw_mode;	/* Display Mode sent to the controller */
+	bool	in_txn;		/* between lcd_begin() and lcd_commit() */
 	uint8_t	cfg_rows;
 	uint8_t	row_offsets[4];
+	uint8_t	addr;		/* DDRAM address counter */
 };
 
 /* Default Configuration - User can update */
@@ -131,10 +94,41 @@ struct pi_lcd_data lcd_data = {
 	.disp_func = LCD_4BIT_MODE | LCD_2_LINE | LCD_5x8_DOTS,
 	.disp_cntl = 0,
 	.disp_mode = 0,
+	.hw_cntl = LCD_STATE_UNKNOWN,
+	.hw_mode = LCD_STATE_UNKNOWN,
+	.in_txn = false,
 	.cfg_rows = 0,
-	.row_offsets = {0x00, 0x00, 0x00, 0x00}
+	.row_offsets = {0x00, 0x00, 0x00, 0x00},
+	.addr = LCD_ADDR_UNKNOWN
+};
+
+/* RAM copy of the display. cells is what should be shown, shadow is what
+ * the controller DDRAM contains. lcd_flush() only sends the differences.
+ */
+struct lcd_framebuffer {
+	uint8_t cells[LCD_ROWS][LCD_COLS];
+	uint8_t shadow[LCD_ROWS][LCD_COLS];
+	uint8_t col;
+	uint8_t row;
 };
 
+static struct lcd_framebuffer lcd_fb;
+
+static struct lcd_stats lcd_stats;
+/* Kept in ns rather than cycles: the cycle rate changes with the clock profile */
+static uint64_t lcd_bus_ns;
+
+static uint8_t lcd_stats_bucket(uint32_t usec)
+{
+	uint8_t bucket = 0;
+
+	while (usec && (bucket < (LCD_STATS_HIST_BUCKETS - 1))) {
+		usec >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
 void _set_row_offsets(int8_t row0, int8_t row1, int8_t row2, int8_t row3)
 {
 	lcd_data.row_offsets[0] = row0;
@@ -143,73 +137,21 @@ void _set_row_offsets(int8_t row0, int8_t row1, int8_t row2, int8_t row3)
 	lcd_data.row_offsets[3] = row3;
 }
 
-static inline void lcd_gpio_write(struct gpio_info* gpios, enum gpio_index idx, int value)
+static void _pi_lcd_nibble_wr(const struct lcd_bus *bus, uint8_t nibble)
 {
-	struct gpio_info *gi = &gpios[idx];
-	if (gpio_pin_set_raw(gi->dev, gi->index, value)) {
-		printk("Failed to set idx %d to %d\n", idx, value);
-	}
+	bus->write_nibble(nibble);
+	bus->pulse_e();
 }
 
-void _pi_lcd_toggle_enable(struct gpio_info* gpios)
-{
-	lcd_gpio_write(gpios, GPIO_IDX_E, LOW);
-	k_msleep(ENABLE_DELAY);
-	lcd_gpio_write(gpios, GPIO_IDX_E, HIGH);
-	k_msleep(ENABLE_DELAY);
-	lcd_gpio_write(gpios, GPIO_IDX_E, LOW);
-	k_msleep(ENABLE_DELAY);
-}
-
-
-void _pi_lcd_4bits_wr(struct gpio_info* gpios, uint8_t bits)
+void _pi_lcd_4bits_wr(const struct lcd_bus *bus, uint8_t bits)
 {
 	/* High bits */
-	lcd_gpio_write(gpios, GPIO_IDX_D4, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D5, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D6, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D7, LOW);
-	
-	if ((bits & BIT(4)) == BIT(4)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D4, HIGH);
-	}
-	if ((bits & BIT(5)) == BIT(5)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D5, HIGH);
-	}
-	if ((bits & BIT(6)) == BIT(6)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D6, HIGH);
-	}
-	if ((bits & BIT(7)) == BIT(7)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D7, HIGH);
-	}
-
-	/* Toggle 'Enable' pin */
-	_pi_lcd_toggle_enable(gpios);
-
+	_pi_lcd_nibble_wr(bus, bits >> 4);
 	/* Low bits */
-	lcd_gpio_write(gpios, GPIO_IDX_D4, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D5, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D6, LOW);
-	lcd_gpio_write(gpios, GPIO_IDX_D7, LOW);
-
-	if ((bits & BIT(0)) == BIT(0)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D4, HIGH);
-	}
-	if ((bits & BIT(1)) == BIT(1)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D5, HIGH);
-	}
-	if ((bits & BIT(2)) == BIT(2)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D6, HIGH);
-	}
-	if ((bits & BIT(3)) == BIT(3)) {
-		lcd_gpio_write(gpios, GPIO_IDX_D7, HIGH);
-	}
-
-	/* Toggle 'Enable' pin */
-	_pi_lcd_toggle_enable(gpios);
+	_pi_lcd_nibble_wr(bus, bits & 0x0F);
 }
 
-void _pi_lcd_8bits_wr(struct gpio_info* gpios, uint8_t bits)
+void _pi_lcd_8bits_wr(const struct lcd_bus *bus, uint8_t bits)
 {
 #if 0
 	/* High bits */
@@ -253,31 +195,246 @@ void _pi_lcd_8bits_wr(struct gpio_info* gpios, uint8_t bits)
 #endif
 }
 
-void _pi_lcd_data(struct gpio_info* gpios, uint8_t bits)
+void _pi_lcd_data(const struct lcd_bus *bus, uint8_t bits)
 {
+	uint32_t start = k_cycle_get_32();
+
 	if (lcd_data.disp_func & LCD_8BIT_MODE) {
 #if 0
-		_pi_lcd_8bits_wr(gpios, bits);
+		_pi_lcd_8bits_wr(bus, bits);
 #else
-		printk("8 Bit mode not implemented\n\n");
+		LOG_ERR("8 Bit mode not implemented");
 #endif
 	} else {
-		_pi_lcd_4bits_wr(gpios, bits);
+		_pi_lcd_4bits_wr(bus, bits);
+	}
+
+	lcd_bus_ns += k_cyc_to_ns_floor64(k_cycle_get_32() - start);
+}
+
+#ifdef CONFIG_APP_LCD_TIMING_TIMER_ISR
+/* Transmit queue drained by the TIM6 interrupt. Every byte is clocked out
+ * in 4 timer ticks: high nibble with E high, E low, low nibble with E high,
+ * E low. The last tick lasts for the execution time of the instruction.
+ */
+#define LCD_TX_TIMER			TIM6
+#define LCD_TX_IRQ			TIM6_DAC_IRQn
+#define LCD_TX_IRQ_PRIO			2
+#define LCD_TX_QUEUE_SIZE		64	/* power of 2 */
+
+struct lcd_tx_entry {
+	uint8_t bits;
+	uint8_t rs;
+	uint16_t exec_us;
+};
+
+struct lcd_tx_queue {
+	struct lcd_tx_entry entries[LCD_TX_QUEUE_SIZE];
+	volatile uint32_t head;		/* written by the thread */
+	volatile uint32_t tail;		/* written by the isr */
+	uint8_t phase;
+	volatile bool busy;
+	bool started;
+	struct k_sem space;
+	struct k_sem done;
+};
+
+static struct lcd_tx_queue lcd_tx;
+
+/** Fire the timer interrupt in usec microseconds */
+static inline void lcd_tx_timer_start(uint32_t usec)
+{
+	LL_TIM_SetAutoReload(LCD_TX_TIMER, MAX(usec, 1U) - 1);
+	LL_TIM_SetCounter(LCD_TX_TIMER, 0);
+	LL_TIM_EnableCounter(LCD_TX_TIMER);
+}
+
+static void lcd_tx_isr(void *arg)
+{
+	struct lcd_tx_entry *e;
+	uint32_t next_us = LCD_ENABLE_PULSE_US;
+	uint32_t start = k_cycle_get_32();
+
+	ARG_UNUSED(arg);
+
+	if (!LL_TIM_IsActiveFlag_UPDATE(LCD_TX_TIMER)) {
+		return;
+	}
+	LL_TIM_ClearFlag_UPDATE(LCD_TX_TIMER);
+
+	if (lcd_tx.tail == lcd_tx.head) {
+		lcd_tx.busy = false;
+		power_stop_unlock();
+		k_sem_give(&lcd_tx.done);
+		return;
+	}
+
+	e = &lcd_tx.entries[lcd_tx.tail & (LCD_TX_QUEUE_SIZE - 1)];
+
+	/* RS and data are written before E rises, that is more than t_AS */
+	switch (lcd_tx.phase) {
+	case 0:
+		lcd_bus_gpio.set_rs(e->rs);
+		lcd_bus_gpio.write_nibble(e->bits >> 4);
+		lcd_bus_gpio_set_e(true);
+		break;
+	case 2:
+		lcd_bus_gpio.write_nibble(e->bits & 0x0F);
+		lcd_bus_gpio_set_e(true);
+		break;
+	case 1:
+		lcd_bus_gpio_set_e(false);
+		next_us = LCD_ENABLE_CYCLE_US;
+		break;
+	case 3:
+	default:
+		lcd_bus_gpio_set_e(false);
+		next_us = e->exec_us;
+		lcd_tx.tail++;
+		k_sem_give(&lcd_tx.space);
+		break;
 	}
+	lcd_tx.phase = (lcd_tx.phase + 1) & 0x03;
+
+	lcd_tx_timer_start(next_us);
+	lcd_bus_ns += k_cyc_to_ns_floor64(k_cycle_get_32() - start);
+}
+
+static void lcd_tx_enqueue(uint8_t bits, bool rs, uint16_t exec_us)
+{
+	struct lcd_tx_entry *e;
+	unsigned int key;
+
+	while ((lcd_tx.head - lcd_tx.tail) >= LCD_TX_QUEUE_SIZE) {
+		k_sem_take(&lcd_tx.space, K_FOREVER);
+	}
+
+	e = &lcd_tx.entries[lcd_tx.head & (LCD_TX_QUEUE_SIZE - 1)];
+	e->bits = bits;
+	e->rs = rs;
+	e->exec_us = exec_us;
+
+	key = irq_lock();
+	lcd_tx.head++;
+	if (!lcd_tx.busy) {
+		lcd_tx.busy = true;
+		/* TIM6 stops in STOP mode */
+		power_stop_lock();
+		lcd_tx_timer_start(1);
+	}
+	irq_unlock(key);
 }
 
-void _pi_lcd_command(struct gpio_info* gpios, uint8_t bits)
+static struct device *lcd_tx_clk;
+
+/** 1 MHz count on the APB1 timer clock */
+static void lcd_tx_timing(void)
 {
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB1,
+		.enr = LL_APB1_GRP1_PERIPH_TIM6
+	};
+	uint32_t rate;
+
+	if (clock_control_get_rate(lcd_tx_clk, (clock_control_subsys_t *)&pclken, &rate)) {
+		return;
+	}
+
+	/* timers on a divided APB run at twice the bus clock */
+	if (LL_RCC_GetAPB1Prescaler() != LL_RCC_APB1_DIV_1) {
+		rate *= 2U;
+	}
+
+	LL_TIM_SetPrescaler(LCD_TX_TIMER, rate / USEC_PER_SEC - 1);
+	/* load it now, a running phase starts over and only gets longer */
+	LL_TIM_GenerateEvent_UPDATE(LCD_TX_TIMER);
+}
+
+static struct power_clock_listener lcd_tx_clock_listener = {
+	.changed = lcd_tx_timing,
+};
+
+static bool lcd_tx_init(void)
+{
+	struct stm32_pclken pclken = {
+		.bus = STM32_CLOCK_BUS_APB1,
+		.enr = LL_APB1_GRP1_PERIPH_TIM6
+	};
+
+	lcd_tx_clk = device_get_binding(STM32_CLOCK_CONTROL_NAME);
+	if (!lcd_tx_clk || clock_control_on(lcd_tx_clk, (clock_control_subsys_t *)&pclken)) {
+		LOG_ERR("Failed to clock lcd tx timer");
+		return false;
+	}
+
+	k_sem_init(&lcd_tx.space, 0, 1);
+	k_sem_init(&lcd_tx.done, 0, 1);
+
+	/* stop after each update event */
+	LL_TIM_SetOnePulseMode(LCD_TX_TIMER, LL_TIM_ONEPULSEMODE_SINGLE);
+	LL_TIM_SetUpdateSource(LCD_TX_TIMER, LL_TIM_UPDATESOURCE_COUNTER);
+	lcd_tx_timing();
+	LL_TIM_ClearFlag_UPDATE(LCD_TX_TIMER);
+	LL_TIM_EnableIT_UPDATE(LCD_TX_TIMER);
+
+	IRQ_CONNECT(LCD_TX_IRQ, LCD_TX_IRQ_PRIO, lcd_tx_isr, NULL, 0);
+	irq_enable(LCD_TX_IRQ);
+	power_clock_listen(&lcd_tx_clock_listener);
+
+	lcd_tx.started = true;
+	return true;
+}
+#endif
+
+/** Send one instruction or character and wait for its execution */
+static void _pi_lcd_send(const struct lcd_bus *bus, uint8_t bits, bool rs, uint16_t exec_us)
+{
+#ifdef CONFIG_APP_LCD_TIMING_TIMER_ISR
+	if (lcd_tx.started) {
+		lcd_tx_enqueue(bits, rs, exec_us);
+		return;
+	}
+#endif
+	bus->set_rs(rs);
+	_pi_lcd_data(bus, bits);
+	bus->delay(exec_us);
+}
+
+void _pi_lcd_command(const struct lcd_bus *bus, uint8_t bits)
+{
+	uint16_t exec_us = LCD_EXEC_US;
+
+	/* track the address counter, so lcd_flush() can skip addressing */
+	if (bits & LCD_SET_DDRAM_ADDR) {
+		lcd_data.addr = bits & ~LCD_SET_DDRAM_ADDR;
+	} else if ((bits & LCD_SET_CGRAM_ADDR) ||
+		   ((bits & ~0x0F) == LCD_CURSOR_SHIFT && !(bits & LCD_DISPLAY_MOVE))) {
+		lcd_data.addr = LCD_ADDR_UNKNOWN;
+	}
+
+	/* clear and home are the only slow instructions */
+	if ((bits == LCD_CLEAR_DISPLAY) || ((bits & ~0x01) == LCD_RETURN_HOME)) {
+		lcd_data.addr = 0;
+		exec_us = LCD_EXEC_CLEAR_US;
+	}
+	if (bits == LCD_CLEAR_DISPLAY) {
+		lcd_stats.clears++;
+	}
+	lcd_stats.commands++;
+
 	/* mode = False for command */
-	lcd_gpio_write(gpios, GPIO_IDX_RS, LOW);
-	_pi_lcd_data(gpios, bits);
+	_pi_lcd_send(bus, bits, false, exec_us);
 }
 
-void _pi_lcd_write(struct gpio_info* gpios, uint8_t bits)
+void _pi_lcd_write(const struct lcd_bus *bus, uint8_t bits)
 {
+	if (lcd_data.addr != LCD_ADDR_UNKNOWN) {
+		lcd_data.addr++;
+	}
+	lcd_stats.data++;
+
 	/* mode = True for character */
-	lcd_gpio_write(gpios, GPIO_IDX_RS, HIGH);
-	_pi_lcd_data(gpios, bits);
+	_pi_lcd_send(bus, bits, true, LCD_EXEC_DATA_US);
 }
 
 
@@ -285,14 +442,13 @@ void _pi_lcd_write(struct gpio_info* gpios, uint8_t bits)
  * USER can use these APIs
  *************************/
 /** Home */
-void pi_lcd_home(struct gpio_info* gpios)
+void pi_lcd_home(const struct lcd_bus *bus)
 {
-	_pi_lcd_command(gpios, LCD_RETURN_HOME);
-	k_sleep(K_MSEC(2));			/* wait for 2ms */
+	_pi_lcd_command(bus, LCD_RETURN_HOME);
 }
 
 /** Set curson position */
-void pi_lcd_set_cursor(struct gpio_info* gpios, uint8_t col, uint8_t row)
+void pi_lcd_set_cursor(const struct lcd_bus *bus, uint8_t col, uint8_t row)
 {
 	size_t max_lines;
 
@@ -303,115 +459,125 @@ void pi_lcd_set_cursor(struct gpio_info* gpios, uint8_t col, uint8_t row)
 	if (row >= lcd_data.cfg_rows) {
 		row = lcd_data.cfg_rows - 1;    /* Count rows starting w/0 */
 	}
-	_pi_lcd_command(gpios, (LCD_SET_DDRAM_ADDR | (col + lcd_data.row_offsets[row])));
+	_pi_lcd_command(bus, (LCD_SET_DDRAM_ADDR | (col + lcd_data.row_offsets[row])));
 }
 
 
 /** Clear display */
-void pi_lcd_clear(struct gpio_info* gpios)
+void pi_lcd_clear(const struct lcd_bus *bus)
+{
+	_pi_lcd_command(bus, LCD_CLEAR_DISPLAY);
+	(void)memset(lcd_fb.shadow, ' ', sizeof(lcd_fb.shadow));
+}
+
+
+/** Send the display control if it differs from the controller state */
+static void pi_lcd_update_cntl(const struct lcd_bus *bus)
 {
-	_pi_lcd_command(gpios, LCD_CLEAR_DISPLAY);
-	k_sleep(K_MSEC(2));			/* wait for 2ms */
+	if (lcd_data.in_txn || (lcd_data.disp_cntl == lcd_data.hw_cntl)) {
+		return;
+	}
+	_pi_lcd_command(bus, LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	lcd_data.hw_cntl = lcd_data.disp_cntl;
 }
 
+/** Send the entry mode if it differs from the controller state */
+static void pi_lcd_update_mode(const struct lcd_bus *bus)
+{
+	if (lcd_data.in_txn || (lcd_data.disp_mode == lcd_data.hw_mode)) {
+		return;
+	}
+	_pi_lcd_command(bus, LCD_ENTRY_MODE_SET | lcd_data.disp_mode);
+	lcd_data.hw_mode = lcd_data.disp_mode;
+}
 
 /** Display ON */
-void pi_lcd_display_on(struct gpio_info* gpios)
+void pi_lcd_display_on(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl |= LCD_DISPLAY_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 /** Display OFF */
-void pi_lcd_display_off(struct gpio_info* gpios)
+void pi_lcd_display_off(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl &= ~LCD_DISPLAY_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 
 /** Turns cursor off */
-void pi_lcd_cursor_off(struct gpio_info* gpios)
+void pi_lcd_cursor_off(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl &= ~LCD_CURSOR_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 /** Turn cursor on */
-void pi_lcd_cursor_on(struct gpio_info* gpios)
+void pi_lcd_cursor_on(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl |= LCD_CURSOR_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 
 /** Turn off the blinking cursor */
-void pi_lcd_blink_off(struct gpio_info* gpios)
+void pi_lcd_blink_off(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl &= ~LCD_BLINK_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 /** Turn on the blinking cursor */
-void pi_lcd_blink_on(struct gpio_info* gpios)
+void pi_lcd_blink_on(const struct lcd_bus *bus)
 {
 	lcd_data.disp_cntl |= LCD_BLINK_ON;
-	_pi_lcd_command(gpios,
-			LCD_DISPLAY_CONTROL | lcd_data.disp_cntl);
+	pi_lcd_update_cntl(bus);
 }
 
 /** Scroll the display left without changing the RAM */
-void pi_lcd_scroll_left(struct gpio_info* gpios)
+void pi_lcd_scroll_left(const struct lcd_bus *bus)
 {
-	_pi_lcd_command(gpios, LCD_CURSOR_SHIFT |
+	_pi_lcd_command(bus, LCD_CURSOR_SHIFT |
 			LCD_DISPLAY_MOVE | LCD_MOVE_LEFT);
 }
 
 /** Scroll the display right without changing the RAM */
-void pi_lcd_scroll_right(struct gpio_info* gpios)
+void pi_lcd_scroll_right(const struct lcd_bus *bus)
 {
-	_pi_lcd_command(gpios, LCD_CURSOR_SHIFT |
+	_pi_lcd_command(bus, LCD_CURSOR_SHIFT |
 			LCD_DISPLAY_MOVE | LCD_MOVE_RIGHT);
 }
 
 /** Text that flows from left to right */
-void pi_lcd_left_to_right(struct gpio_info* gpios)
+void pi_lcd_left_to_right(const struct lcd_bus *bus)
 {
 	lcd_data.disp_mode |= LCD_ENTRY_LEFT;
-	_pi_lcd_command(gpios,
-			LCD_ENTRY_MODE_SET | lcd_data.disp_cntl);
+	pi_lcd_update_mode(bus);
 }
 
 /** Text that flows from right to left */
-void pi_lcd_right_to_left(struct gpio_info* gpios)
+void pi_lcd_right_to_left(const struct lcd_bus *bus)
 {
 	lcd_data.disp_mode &= ~LCD_ENTRY_LEFT;
-	_pi_lcd_command(gpios,
-			LCD_ENTRY_MODE_SET | lcd_data.disp_cntl);
+	pi_lcd_update_mode(bus);
 }
 
 /** Right justify text from the cursor location */
-void pi_lcd_auto_scroll_right(struct gpio_info* gpios)
+void pi_lcd_auto_scroll_right(const struct lcd_bus *bus)
 {
 	lcd_data.disp_mode |= LCD_ENTRY_SHIFT_INCREMENT;
-	_pi_lcd_command(gpios,
-			LCD_ENTRY_MODE_SET | lcd_data.disp_cntl);
+	pi_lcd_update_mode(bus);
 }
 
 /** Left justify text from the cursor location */
-void pi_lcd_auto_scroll_left(struct gpio_info* gpios)
+void pi_lcd_auto_scroll_left(const struct lcd_bus *bus)
 {
 	lcd_data.disp_mode &= ~LCD_ENTRY_SHIFT_INCREMENT;
-	_pi_lcd_command(gpios,
-			LCD_ENTRY_MODE_SET | lcd_data.disp_cntl);
+	pi_lcd_update_mode(bus);
 }
 
-void pi_lcd_string(struct gpio_info* gpios, const char *msg)
+void pi_lcd_string(const struct lcd_bus *bus, const char *msg)
 {
 	int i;
 	int len = 0;
@@ -419,23 +585,25 @@ void pi_lcd_string(struct gpio_info* gpios, const char *msg)
 
 	len = strlen(msg);
 	if (len > LCD_WIDTH) {
-		printk("Too long message! len %d %s\n", len, msg);
+		LOG_WRN("Too long message! len %d %s", len, log_strdup(msg));
 	}
 
 	for (i = 0; i < len; i++) {
 		data = msg[i];
-		_pi_lcd_write(gpios, data);
+		_pi_lcd_write(bus, data);
 	}
 }
 
 
 /** LCD initialization function */
-void pi_lcd_init(struct gpio_info *gpios, uint8_t cols, uint8_t rows, uint8_t dotsize)
+void pi_lcd_init(const struct lcd_bus *bus, uint8_t cols, uint8_t rows, uint8_t dotsize)
 {
 	if (rows > 1) {
 		lcd_data.disp_func |= LCD_2_LINE;
 	}
 	lcd_data.cfg_rows = rows;
+	lcd_data.hw_cntl = LCD_STATE_UNKNOWN;
+	lcd_data.hw_mode = LCD_STATE_UNKNOWN;
 
 	_set_row_offsets(0x00, 0x40, 0x00 + cols, 0x40 + cols);
 
@@ -449,7 +617,7 @@ void pi_lcd_init(struct gpio_info *gpios, uint8_t cols, uint8_t rows, uint8_t do
 	 * above 2.7V before sending commands. Arduino can turn on way
 	 * before 4.5V so we'll wait 50
 	 */
-	k_sleep(K_MSEC(50 * 2));
+	k_usleep(LCD_POWER_ON_US);
 
 	/* this is according to the hitachi HD44780 datasheet
 	 * figure 23/24, pg 45/46 try to set 4/8 bits mode
@@ -457,148 +625,493 @@ void pi_lcd_init(struct gpio_info *gpios, uint8_t cols, uint8_t rows, uint8_t do
 	if (lcd_data.disp_func & LCD_8BIT_MODE) {
 #if 0
 		/* 1st try */
-		_pi_lcd_command(gpios, 0x30);
+		_pi_lcd_command(bus, 0x30);
 		k_sleep(K_MSEC(5));			/* wait for 5ms */
 
 		/* 2nd try */
-		_pi_lcd_command(gpios, 0x30);
+		_pi_lcd_command(bus, 0x30);
 		k_sleep(K_MSEC(5));			/* wait for 5ms */
 
 		/* 3rd try */
-		_pi_lcd_command(gpios, 0x30);
+		_pi_lcd_command(bus, 0x30);
 		k_sleep(K_MSEC(1));			/* wait for 1ms */
 
 		/* Set 4bit interface */
-		_pi_lcd_command(gpios, 0x30);
+		_pi_lcd_command(bus, 0x30);
 #else
-		printk("8Bit mode not impl\n\n");
+		LOG_ERR("8Bit mode not impl");
 #endif
 	} else {
+		/* the controller is still in 8 bit mode, so only the
+		 * high nibble of each instruction is transferred
+		 */
+		bus->set_rs(false);
+
 		/* 1st try */
-		_pi_lcd_command(gpios, 0x03);
-		k_sleep(K_MSEC(5 * 2));			/* wait for 5ms */
+		_pi_lcd_nibble_wr(bus, 0x03);
+		bus->delay(LCD_INIT_1ST_US);
 
 		/* 2nd try */
-		_pi_lcd_command(gpios, 0x03);
-		k_sleep(K_MSEC(5 * 2));			/* wait for 5ms */
+		_pi_lcd_nibble_wr(bus, 0x03);
+		bus->delay(LCD_INIT_2ND_US);
 
 		/* 3rd try */
-		_pi_lcd_command(gpios, 0x03);
-		k_sleep(K_MSEC(1 * 3));			/* wait for 1ms */
+		_pi_lcd_nibble_wr(bus, 0x03);
+		bus->delay(LCD_EXEC_US);
 
 		/* Set 4bit interface */
-		_pi_lcd_command(gpios, 0x02);
+		_pi_lcd_nibble_wr(bus, 0x02);
+		bus->delay(LCD_EXEC_US);
 	}
 
 	/* finally, set # lines, font size, etc. */
-	_pi_lcd_command(gpios, (LCD_FUNCTION_SET | lcd_data.disp_func));
+	_pi_lcd_command(bus, (LCD_FUNCTION_SET | lcd_data.disp_func));
 
 	/* turn the display on with no cursor or blinking default */
 	lcd_data.disp_cntl = LCD_DISPLAY_ON | LCD_CURSOR_OFF | LCD_BLINK_OFF;
-	pi_lcd_display_on(gpios);
+	pi_lcd_display_on(bus);
 
 	/* clear it off */
-	pi_lcd_clear(gpios);
+	pi_lcd_clear(bus);
 
 	/* Initialize to default text direction */
 	lcd_data.disp_mode = LCD_ENTRY_LEFT | LCD_ENTRY_SHIFT_DECREMENT;
 	/* set the entry mode */
-	_pi_lcd_command(gpios, LCD_ENTRY_MODE_SET | lcd_data.disp_mode);
+	pi_lcd_update_mode(bus);
+}
+
+#define LCD_CGRAM_SLOTS			8
+#define LCD_GLYPH_NONE			0xFF
+
+static const uint8_t lcd_glyphs[LCD_GLYPH_COUNT][8] = {
+	[LCD_GLYPH_SUN] = {
+		0b00000,
+		0b10101,
+		0b01110,
+		0b11011,
+		0b01110,
+		0b10101,
+		0b00000,
+		0b00000,
+	},
+	[LCD_GLYPH_MOON] = {
+		0b00110,
+		0b01100,
+		0b11000,
+		0b11000,
+		0b11000,
+		0b01100,
+		0b00110,
+		0b00000,
+	},
+	[LCD_GLYPH_FROST] = {
+		0b00100,
+		0b10101,
+		0b01110,
+		0b11111,
+		0b01110,
+		0b10101,
+		0b00100,
+		0b00000,
+	},
+	[LCD_GLYPH_AE] = {
+		0b01010,
+		0b00000,
+		0b01110,
+		0b10001,
+		0b11111,
+		0b10001,
+		0b10001,
+		0b00000,
+	},
+	[LCD_GLYPH_OE] = {
+		0b01010,
+		0b00000,
+		0b01110,
+		0b10001,
+		0b10001,
+		0b10001,
+		0b01110,
+		0b00000,
+	},
+	[LCD_GLYPH_UE] = {
+		0b01010,
+		0b00000,
+		0b10001,
+		0b10001,
+		0b10001,
+		0b10001,
+		0b01110,
+		0b00000,
+	},
+};
+
+/* Glyphs resident in the 8 CGRAM slots, the least recently used slot is
+ * replaced when a glyph is not resident.
+ */
+struct lcd_glyph_cache {
+	uint8_t slot_glyph[LCD_CGRAM_SLOTS];
+	uint32_t slot_used[LCD_CGRAM_SLOTS];
+	uint32_t stamp;
+	uint32_t uploads;
+};
+
+static struct lcd_glyph_cache lcd_cgram;
+
+static inline bool lcd_is_glyph(uint8_t c)
+{
+	return (c >= LCD_GLYPH_CHAR(0)) && (c < LCD_GLYPH_CHAR(LCD_GLYPH_COUNT));
 }
 
-static bool gpio_init(struct gpio_info* gpios, int length)
+static void lcd_glyph_cache_reset(void)
 {
-	for (int i = 0; i < length; i++) {
-		gpios[i].dev = device_get_binding(gpios[i].port);
-		if (!gpios[i].dev) {
-			printk("Cannot find %s!\n", gpios[i].port);
-			return false;
+	(void)memset(lcd_cgram.slot_glyph, LCD_GLYPH_NONE, sizeof(lcd_cgram.slot_glyph));
+	(void)memset(lcd_cgram.slot_used, 0, sizeof(lcd_cgram.slot_used));
+}
+
+static int lcd_glyph_find(uint8_t glyph)
+{
+	for (int slot = 0; slot < LCD_CGRAM_SLOTS; slot++) {
+		if (lcd_cgram.slot_glyph[slot] == glyph) {
+			return slot;
 		}
-		if (gpio_pin_configure(gpios[i].dev, gpios[i].index, GPIO_OUTPUT)) {
-			printk("Failed to set %s_%d as output\n", gpios[i].port, gpios[i].index);
-			return false;
+	}
+	return -1;
+}
+
+/** Mark the resident glyphs of the framebuffer, they must not be evicted */
+static uint8_t lcd_glyph_pin_frame(void)
+{
+	uint8_t pinned = 0;
+
+	lcd_cgram.stamp++;
+	for (uint8_t row = 0; row < LCD_ROWS; row++) {
+		for (uint8_t col = 0; col < LCD_COLS; col++) {
+			uint8_t c = lcd_fb.cells[row][col];
+			int slot;
+
+			if (!lcd_is_glyph(c)) {
+				continue;
+			}
+			slot = lcd_glyph_find(c - LCD_GLYPH_CHAR(0));
+			if (slot >= 0) {
+				pinned |= BIT(slot);
+				lcd_cgram.slot_used[slot] = lcd_cgram.stamp;
+			}
 		}
 	}
-	return true;
+	return pinned;
+}
+
+/** Get the CGRAM character code for a glyph, upload it if necessary */
+static uint8_t lcd_glyph_slot(const struct lcd_bus *bus, uint8_t glyph, uint8_t *pinned)
+{
+	int slot = lcd_glyph_find(glyph);
+
+	if (slot < 0) {
+		for (int i = 0; i < LCD_CGRAM_SLOTS; i++) {
+			if (*pinned & BIT(i)) {
+				continue;
+			}
+			if ((slot < 0) ||
+			    (lcd_cgram.slot_used[i] < lcd_cgram.slot_used[slot])) {
+				slot = i;
+			}
+		}
+		if (slot < 0) {
+			LOG_WRN("No free CGRAM slot for glyph %d", glyph);
+			return ' ';
+		}
+
+		_pi_lcd_command(bus, LCD_SET_CGRAM_ADDR | (slot << 3));
+		for (int row = 0; row < ARRAY_SIZE(lcd_glyphs[glyph]); row++) {
+			_pi_lcd_write(bus, lcd_glyphs[glyph][row]);
+		}
+		lcd_cgram.slot_glyph[slot] = glyph;
+		lcd_cgram.uploads++;
+	}
+
+	*pinned |= BIT(slot);
+	lcd_cgram.slot_used[slot] = lcd_cgram.stamp;
+	return slot;
+}
+
+struct lcd_utf8_map {
+	uint8_t lead;
+	uint8_t cont;
+	uint8_t c;
+};
+
+/* characters of the A00 rom and glyphs for the missing ones */
+static const struct lcd_utf8_map lcd_utf8[] = {
+	{0xC3, 0xA4, 0xE1},			/* ä */
+	{0xC3, 0xB6, 0xEF},			/* ö */
+	{0xC3, 0xBC, 0xF5},			/* ü */
+	{0xC3, 0x9F, 0xE2},			/* ß */
+	{0xC2, 0xB0, 0xDF},			/* ° */
+	{0xC3, 0x84, LCD_GLYPH_CHAR(LCD_GLYPH_AE)},	/* Ä */
+	{0xC3, 0x96, LCD_GLYPH_CHAR(LCD_GLYPH_OE)},	/* Ö */
+	{0xC3, 0x9C, LCD_GLYPH_CHAR(LCD_GLYPH_UE)},	/* Ü */
+};
+
+/** Get the next lcd character from a utf-8 string */
+static uint8_t lcd_char_from_utf8(const char **msg)
+{
+	const uint8_t *p = (const uint8_t *)*msg;
+
+	(*msg)++;
+	if ((p[0] != 0xC2) && (p[0] != 0xC3)) {
+		return p[0];
+	}
+	if (p[1] == '\0') {
+		return '?';
+	}
+
+	(*msg)++;
+	for (int i = 0; i < ARRAY_SIZE(lcd_utf8); i++) {
+		if ((lcd_utf8[i].lead == p[0]) && (lcd_utf8[i].cont == p[1])) {
+			return lcd_utf8[i].c;
+		}
+	}
+	return '?';
+}
+
+#ifdef CONFIG_APP_LCD_BENCHMARK
+/** Measure the bus cost of a full screen of characters */
+static void lcd_benchmark(const struct lcd_bus *bus)
+{
+	const int count = 32;
+	uint32_t bus_cycles = 0;
+	uint32_t start = k_cycle_get_32();
+
+	bus->set_rs(true);
+	for (int i = 0; i < count; i++) {
+		uint32_t bus_start = k_cycle_get_32();
+
+		_pi_lcd_data(bus, ' ');
+		bus_cycles += k_cycle_get_32() - bus_start;
+		bus->delay(LCD_EXEC_DATA_US);
+	}
+
+	LOG_INF("LCD benchmark (%s bus): %d bytes in %u us, bus %u ns/byte",
+		bus->name, count,
+		k_cyc_to_us_floor32(k_cycle_get_32() - start),
+		(uint32_t)(k_cyc_to_ns_floor64(bus_cycles) / count));
+
+	pi_lcd_clear(bus);
 }
+#endif
 
 void *lcd_init(void)
 {
-	struct gpio_info* gpios = global_gpios;
-	int ret;
+	const struct lcd_bus *bus = &LCD_BUS;
 
-	ret = gpio_init(gpios, ARRAY_SIZE(global_gpios));
-	
-	if (!ret) {
-		printk("Failed to init lcd gpios\n");
+	if (!bus->init()) {
+		LOG_ERR("Failed to init lcd %s bus", bus->name);
 		return NULL;
 	}
 
-	printk("LCD Init\n");
-	pi_lcd_init(gpios, 16, 2, LCD_5x8_DOTS);
+	LOG_INF("LCD Init");
+	pi_lcd_init(bus, LCD_COLS, LCD_ROWS, LCD_5x8_DOTS);
+	lcd_glyph_cache_reset();
+	lcd_clear((void *)bus);
+
+#ifdef CONFIG_APP_LCD_BENCHMARK
+	lcd_benchmark(bus);
+#endif
+
+#ifdef CONFIG_APP_LCD_TIMING_TIMER_ISR
+	/* from now on the bus is driven by the timer interrupt */
+	if (!lcd_tx_init()) {
+		return NULL;
+	}
+#endif
 
-	return gpios;
+	return (void *)bus;
 }
 
+#ifndef CONFIG_APP_BACKLIGHT_PWM
 void lcd_backlight(void* lcd, bool enable)
 {
-	struct gpio_info* gpios = lcd;
+	const struct lcd_bus *bus = lcd;
 
-	lcd_gpio_write(gpios, GPIO_IDX_BL, enable ? HIGH : LOW);
+	bus->backlight(enable);
 }
+#endif
 
 void lcd_clear(void* lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_clear(gpios);
+	ARG_UNUSED(lcd);
+
+	(void)memset(lcd_fb.cells, ' ', sizeof(lcd_fb.cells));
+	lcd_fb.col = 0;
+	lcd_fb.row = 0;
 }
 
 void lcd_set_cursor(void* lcd, uint8_t col, uint8_t row)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_set_cursor(gpios, col, row);
+	ARG_UNUSED(lcd);
+
+	lcd_fb.col = MIN(col, LCD_COLS - 1);
+	lcd_fb.row = MIN(row, LCD_ROWS - 1);
 }
 
 void lcd_string(void* lcd, const char *msg)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_string(gpios, msg);
+	uint32_t start = k_cycle_get_32();
+
+	ARG_UNUSED(lcd);
+
+	while (*msg && (lcd_fb.col < LCD_COLS)) {
+		lcd_fb.cells[lcd_fb.row][lcd_fb.col++] = lcd_char_from_utf8(&msg);
+	}
+	if (*msg) {
+		LOG_WRN("Too long message! %s", log_strdup(msg));
+	}
+
+	lcd_stats.string_hist[lcd_stats_bucket(
+		k_cyc_to_us_floor32(k_cycle_get_32() - start))]++;
+}
+
+void lcd_begin(void* lcd)
+{
+	ARG_UNUSED(lcd);
+
+	lcd_data.in_txn = true;
+}
+
+void lcd_commit(void* lcd)
+{
+	const struct lcd_bus *bus = lcd;
+
+	lcd_data.in_txn = false;
+	pi_lcd_update_mode(bus);
+	lcd_flush(lcd);
+	pi_lcd_update_cntl(bus);
+}
+
+void lcd_sync(void* lcd)
+{
+	ARG_UNUSED(lcd);
+
+#ifdef CONFIG_APP_LCD_TIMING_TIMER_ISR
+	while (lcd_tx.busy) {
+		k_sem_take(&lcd_tx.done, K_FOREVER);
+	}
+#endif
+}
+
+void lcd_flush(void* lcd)
+{
+	const struct lcd_bus *bus = lcd;
+	uint32_t start = k_cycle_get_32();
+	uint8_t pinned = lcd_glyph_pin_frame();
+
+	for (uint8_t row = 0; row < LCD_ROWS; row++) {
+		for (uint8_t col = 0; col < LCD_COLS; col++) {
+			uint8_t c = lcd_fb.cells[row][col];
+
+			if (lcd_is_glyph(c)) {
+				c = lcd_glyph_slot(bus, c - LCD_GLYPH_CHAR(0), &pinned);
+			}
+			if (c == lcd_fb.shadow[row][col]) {
+				continue;
+			}
+			if (lcd_data.addr != lcd_data.row_offsets[row] + col) {
+				pi_lcd_set_cursor(bus, col, row);
+			}
+			_pi_lcd_write(bus, c);
+			lcd_fb.shadow[row][col] = c;
+		}
+	}
+
+	/* the visible cursor is placed at the last write position */
+	if (lcd_data.disp_cntl & (LCD_CURSOR_ON | LCD_BLINK_ON)) {
+		uint8_t col = MIN(lcd_fb.col, LCD_COLS - 1);
+
+		if (lcd_data.addr != lcd_data.row_offsets[lcd_fb.row] + col) {
+			pi_lcd_set_cursor(bus, col, lcd_fb.row);
+		}
+	}
+
+	lcd_stats.flush_hist[lcd_stats_bucket(
+		k_cyc_to_us_floor32(k_cycle_get_32() - start))]++;
+}
+
+void lcd_stats_get(void* lcd, struct lcd_stats *stats)
+{
+	ARG_UNUSED(lcd);
+
+	*stats = lcd_stats;
+	stats->glyph_uploads = lcd_cgram.uploads;
+	stats->bus_us = (uint32_t)(lcd_bus_ns / NSEC_PER_USEC);
+}
+
+static void lcd_stats_dump_hist(const char *name, const uint32_t *hist)
+{
+	LOG_INF("  %s duration:", name);
+	for (int i = 0; i < LCD_STATS_HIST_BUCKETS; i++) {
+		if (!hist[i]) {
+			continue;
+		}
+		if (i == (LCD_STATS_HIST_BUCKETS - 1)) {
+			LOG_INF("    >= %5u us: %u", 1U << (i - 1), hist[i]);
+		} else {
+			LOG_INF("     < %5u us: %u", 1U << i, hist[i]);
+		}
+	}
+}
+
+void lcd_stats_dump(void* lcd)
+{
+	struct lcd_stats stats;
+
+	lcd_stats_get(lcd, &stats);
+
+	LOG_INF("LCD: %u commands, %u data, %u clears, %u glyph uploads",
+		stats.commands, stats.data, stats.clears, stats.glyph_uploads);
+	LOG_INF("  %u us cpu time on the bus", stats.bus_us);
+	lcd_stats_dump_hist("lcd_string()", stats.string_hist);
+	lcd_stats_dump_hist("lcd_flush()", stats.flush_hist);
+#ifdef CONFIG_APP_LCD_BUS_MODEL
+	lcd_model_dump();
+#endif
 }
 
 void lcd_scroll_right(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_scroll_right(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_scroll_right(bus);
 }
 
 
 void lcd_scroll_left(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_scroll_right(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_scroll_right(bus);
 }
 
 void lcd_cursor_off(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_cursor_off(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_cursor_off(bus);
 }
 
 void lcd_cursor_on(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_cursor_on(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_cursor_on(bus);
 }
 
 void lcd_blink_off(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_blink_off(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_blink_off(bus);
 }
 
 void lcd_blink_on(void *lcd)
 {
-	struct gpio_info* gpios = lcd;
-	pi_lcd_blink_on(gpios);
+	const struct lcd_bus *bus = lcd;
+	pi_lcd_blink_on(bus);
 }
 
@@ -9,17 +9,76 @@
 
 #include <zephyr.h>
 
+/* Custom characters, uploaded to the lcd CGRAM on first use */
+enum lcd_glyph {
+	LCD_GLYPH_SUN = 0,
+	LCD_GLYPH_MOON,
+	LCD_GLYPH_FROST,
+	LCD_GLYPH_AE,
+	LCD_GLYPH_OE,
+	LCD_GLYPH_UE,
+	LCD_GLYPH_COUNT
+};
+
+/* Glyphs are written as these control characters in lcd_string() */
+#define LCD_GLYPH_CHAR(glyph)	(0x10 + (glyph))
+#define LCD_GLYPH_STR_SUN	"\x10"
+#define LCD_GLYPH_STR_MOON	"\x11"
+#define LCD_GLYPH_STR_FROST	"\x12"
+
+/* log2 buckets, [0] < 1 us, [1] < 2 us, ... [13] >= 4096 us */
+#define LCD_STATS_HIST_BUCKETS 14
+
+struct lcd_stats {
+	uint32_t commands;
+	uint32_t data;
+	uint32_t clears;
+	uint32_t glyph_uploads;
+	/* cpu time spent clocking bytes out */
+	uint32_t bus_us;
+	uint32_t string_hist[LCD_STATS_HIST_BUCKETS];
+	uint32_t flush_hist[LCD_STATS_HIST_BUCKETS];
+};
+
 void* lcd_init(void);
 
+#ifndef CONFIG_APP_BACKLIGHT_PWM
 void lcd_backlight(void* lcd, bool enable);
+#endif
 
+/** Clear the framebuffer, the display is changed by lcd_flush() */
 void lcd_clear(void* lcd);
 
-/** Set curson position */
+/** Set curson position in the framebuffer */
 void lcd_set_cursor(void* lcd, uint8_t col, uint8_t row);
 
+/** Write to the framebuffer at the cursor position
+ *
+ * The string is utf-8, german umlauts and the degree sign are mapped to
+ * the lcd character set.
+ */
 void lcd_string(void* lcd, const char *msg);
 
+/** Send the changed framebuffer cells and place the cursor
+ *
+ * With CONFIG_APP_LCD_TIMING_TIMER_ISR the data is only queued, the
+ * function returns before the bus transfer is done.
+ */
+void lcd_flush(void* lcd);
+
+/** Start a transaction
+ *
+ * Cursor, blink and entry mode changes are only recorded until
+ * lcd_commit(), which sends the commands that differ from the controller
+ * state and flushes the framebuffer.
+ */
+void lcd_begin(void* lcd);
+
+void lcd_commit(void* lcd);
+
+/** Wait until all queued data is sent to the lcd */
+void lcd_sync(void* lcd);
+
 void lcd_scroll_right(void *lcd);
 
 void lcd_scroll_left(void *lcd);
@@ -33,4 +92,9 @@ void lcd_blink_on(void *lcd);
 void lcd_blink_off(void *lcd);
 
 
+void lcd_stats_get(void* lcd, struct lcd_stats *stats);
+
+/** Print the bus statistics */
+void lcd_stats_dump(void* lcd);
+
 #endif /* APP_LCD_H */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_LCD_BUS_H
+#define APP_LCD_BUS_H
+
+#include <zephyr.h>
+
+/* Bus timing in microseconds, see HD44780 datasheet table 6 and figure 25.
+ * The execution times are given for fosc = 270 kHz, the values here are
+ * scaled to the worst case fosc = 190 kHz.
+ */
+#define LCD_ENABLE_PULSE_US		1	/* PW_EH >= 450 ns */
+#define LCD_ENABLE_CYCLE_US		1	/* t_cycE >= 1000 ns */
+#define LCD_EXEC_US			53	/* 37 us */
+#define LCD_EXEC_DATA_US		59	/* 37 us + t_ADD 4 us */
+#define LCD_EXEC_CLEAR_US		2160	/* 1.52 ms */
+#define LCD_POWER_ON_US			(50U * USEC_PER_MSEC)
+#define LCD_INIT_1ST_US			4100
+#define LCD_INIT_2ND_US			100
+
+/** Transport of the HD44780 in 4 bit mode
+ *
+ * lcd.c only talks to the controller through these functions, the
+ * backend is selected with CONFIG_APP_LCD_BUS_*.
+ */
+struct lcd_bus {
+	const char *name;
+	bool (*init)(void);
+	/** Put a nibble on D4-D7, it is latched by pulse_e() */
+	void (*write_nibble)(uint8_t nibble);
+	/** Select the instruction (false) or the data register (true) */
+	void (*set_rs)(bool data);
+	/** Pulse E, the controller latches RS and D4-D7 */
+	void (*pulse_e)(void);
+	/** Wait for the execution of the last instruction */
+	void (*delay)(uint32_t usec);
+	void (*backlight)(bool enable);
+};
+
+/** Wait as configured with CONFIG_APP_LCD_TIMING_* */
+static inline void lcd_bus_wait(uint32_t usec)
+{
+#if defined(CONFIG_APP_LCD_TIMING_SLEEP)
+	k_usleep(usec);
+#else
+	k_busy_wait(usec);
+#endif
+}
+
+#if defined(CONFIG_APP_LCD_BUS_GPIO)
+extern const struct lcd_bus lcd_bus_gpio;
+
+/** Set E without waiting, for the timer interrupt transmit queue */
+void lcd_bus_gpio_set_e(bool high);
+#elif defined(CONFIG_APP_LCD_BUS_PCF8574)
+extern const struct lcd_bus lcd_bus_pcf8574;
+#elif defined(CONFIG_APP_LCD_BUS_MODEL)
+extern const struct lcd_bus lcd_bus_model;
+
+struct lcd_model_stats {
+	uint32_t cycles;		/* E pulses */
+	uint32_t instructions;
+	uint32_t data;
+	uint32_t violations;		/* timing and protocol errors */
+	uint64_t bus_ns;		/* simulated bus time */
+};
+
+void lcd_model_stats_get(struct lcd_model_stats *stats);
+
+/** Copy the visible characters of a row, buf gets cols + 1 bytes */
+void lcd_model_line(uint8_t row, char *buf);
+
+/** Get the 8 bytes of a CGRAM character */
+const uint8_t *lcd_model_cgram(uint8_t slot);
+
+/** Print the model state and statistics */
+void lcd_model_dump(void);
+#endif
+
+#endif /* APP_LCD_BUS_H */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(lcd_gpio, CONFIG_APP_LCD_LOG_LEVEL);
+
+#include "lcd_bus.h"
+
+#include <drivers/gpio.h>
+#include <string.h>
+
+#ifdef CONFIG_APP_LCD_BUS_GPIO
+
+#if defined(CONFIG_BOARD_NUCLEO_F429ZI)
+/*	https://wiki.dfrobot.com/Arduino_LCD_KeyPad_Shield__SKU__DFR0009_ */
+/* Define GPIO OUT to LCD */
+#define GPIO_PIN_D4		14	/* DB4 PF14 */
+#define GPIO_PORT_D4	        "GPIOF"
+#define GPIO_PIN_D5		11	/* DB5 PE11 */
+#define GPIO_PORT_D5	        "GPIOE"
+#define GPIO_PIN_D6		9	/* DB6 PE9 */
+#define GPIO_PORT_D6	        "GPIOE"
+#define GPIO_PIN_D7		13	/* DB7 PF13 */
+#define GPIO_PORT_D7	        "GPIOF"
+#define GPIO_PIN_RS		12	/* D8 RS PF12 */
+#define GPIO_PORT_RS	        "GPIOF"
+#define GPIO_PIN_E		15	/* D9 Enable PD15 */
+#define GPIO_PORT_E	        "GPIOD"
+#define GPIO_PIN_BL       14               /* D10 backlight control PD14 */
+#define GPIO_PORT_BL	        "GPIOD"
+#elif defined(CONFIG_BOARD_NUCLEO_F446RE)
+#define GPIO_PIN_D4		5	/* DB4 PB5 */
+#define GPIO_PORT_D4	        "GPIOB"
+#define GPIO_PIN_D5		4	/* DB5 PB4 */
+#define GPIO_PORT_D5	        "GPIOB"
+#define GPIO_PIN_D6		10	/* DB6 PB10 */
+#define GPIO_PORT_D6	        "GPIOB"
+#define GPIO_PIN_D7		8	/* DB7 PA8 */
+#define GPIO_PORT_D7	        "GPIOA"
+#define GPIO_PIN_RS		9	/* D8 RS PA9 */
+#define GPIO_PORT_RS	        "GPIOA"
+#define GPIO_PIN_E		7	/* D9 Enable PC7 */
+#define GPIO_PORT_E	        "GPIOC"
+#define GPIO_PIN_BL       6               /* D10 backlight control PB6 */
+#define GPIO_PORT_BL	        "GPIOB"
+#else
+#error "unsupported board"
+#endif
+
+#define HIGH				1
+#define LOW				0
+
+struct gpio_info {
+	const char* port;
+	const uint8_t index;
+	struct device *dev;
+};
+
+enum gpio_index {
+	GPIO_IDX_D4 = 0,
+	GPIO_IDX_D5,
+	GPIO_IDX_D6,
+	GPIO_IDX_D7,
+	GPIO_IDX_RS,
+	GPIO_IDX_E,
+#ifndef CONFIG_APP_BACKLIGHT_PWM
+	GPIO_IDX_BL,
+#endif
+};
+
+static struct gpio_info global_gpios[] = {
+	{GPIO_PORT_D4, GPIO_PIN_D4, NULL},
+	{GPIO_PORT_D5, GPIO_PIN_D5, NULL},
+	{GPIO_PORT_D6, GPIO_PIN_D6, NULL},
+	{GPIO_PORT_D7, GPIO_PIN_D7, NULL},
+	{GPIO_PORT_RS, GPIO_PIN_RS, NULL},
+	{GPIO_PORT_E, GPIO_PIN_E, NULL},
+#ifndef CONFIG_APP_BACKLIGHT_PWM
+	/* otherwise the pin belongs to the backlight pwm */
+	{GPIO_PORT_BL, GPIO_PIN_BL, NULL},
+#endif
+};
+
+#define LCD_DATA_PINS			4
+
+/* The data pins D4-D7 grouped by gpio port, so a nibble is written with
+ * one masked port write per port. lut[] holds the port value for each
+ * nibble.
+ */
+struct lcd_data_port {
+	struct device *dev;
+	gpio_port_pins_t mask;
+	gpio_port_value_t lut[16];
+};
+
+static struct lcd_data_port data_ports[LCD_DATA_PINS];
+static uint8_t data_port_count;
+
+static inline void lcd_gpio_write(struct gpio_info* gpios, enum gpio_index idx, int value)
+{
+	struct gpio_info *gi = &gpios[idx];
+	if (gpio_pin_set_raw(gi->dev, gi->index, value)) {
+		LOG_ERR("Failed to set idx %d to %d", idx, value);
+	}
+}
+
+void lcd_bus_gpio_set_e(bool high)
+{
+	lcd_gpio_write(global_gpios, GPIO_IDX_E, high ? HIGH : LOW);
+}
+
+static void lcd_bus_gpio_pulse_e(void)
+{
+	/* data and RS are already stable for more than t_AS/t_DSW here */
+	lcd_gpio_write(global_gpios, GPIO_IDX_E, HIGH);
+	k_busy_wait(LCD_ENABLE_PULSE_US);
+	lcd_gpio_write(global_gpios, GPIO_IDX_E, LOW);
+	k_busy_wait(LCD_ENABLE_CYCLE_US);
+}
+
+static void lcd_bus_gpio_write_nibble(uint8_t nibble)
+{
+	for (uint8_t i = 0; i < data_port_count; i++) {
+		struct lcd_data_port *p = &data_ports[i];
+
+		if (gpio_port_set_masked_raw(p->dev, p->mask, p->lut[nibble])) {
+			LOG_ERR("Failed to write nibble to port %d", i);
+		}
+	}
+}
+
+static void lcd_bus_gpio_set_rs(bool data)
+{
+	lcd_gpio_write(global_gpios, GPIO_IDX_RS, data ? HIGH : LOW);
+}
+
+static void lcd_bus_gpio_backlight(bool enable)
+{
+#ifndef CONFIG_APP_BACKLIGHT_PWM
+	lcd_gpio_write(global_gpios, GPIO_IDX_BL, enable ? HIGH : LOW);
+#endif
+}
+
+static bool gpio_init(struct gpio_info* gpios, int length)
+{
+	for (int i = 0; i < length; i++) {
+		gpios[i].dev = device_get_binding(gpios[i].port);
+		if (!gpios[i].dev) {
+			LOG_ERR("Cannot find %s!", gpios[i].port);
+			return false;
+		}
+		if (gpio_pin_configure(gpios[i].dev, gpios[i].index, GPIO_OUTPUT)) {
+			LOG_ERR("Failed to set %s_%d as output", gpios[i].port, gpios[i].index);
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Group D4-D7 by port and build the nibble lookup tables */
+static void lcd_data_ports_init(struct gpio_info* gpios)
+{
+	data_port_count = 0;
+	(void)memset(data_ports, 0, sizeof(data_ports));
+
+	for (int bit = 0; bit < LCD_DATA_PINS; bit++) {
+		struct gpio_info *gi = &gpios[GPIO_IDX_D4 + bit];
+		struct lcd_data_port *p = NULL;
+
+		for (uint8_t i = 0; i < data_port_count; i++) {
+			if (data_ports[i].dev == gi->dev) {
+				p = &data_ports[i];
+				break;
+			}
+		}
+		if (!p) {
+			p = &data_ports[data_port_count++];
+			p->dev = gi->dev;
+		}
+
+		p->mask |= BIT(gi->index);
+		for (int nibble = 0; nibble < ARRAY_SIZE(p->lut); nibble++) {
+			if (nibble & BIT(bit)) {
+				p->lut[nibble] |= BIT(gi->index);
+			}
+		}
+	}
+}
+
+static bool lcd_bus_gpio_init(void)
+{
+	if (!gpio_init(global_gpios, ARRAY_SIZE(global_gpios))) {
+		LOG_ERR("Failed to init lcd gpios");
+		return false;
+	}
+
+	lcd_data_ports_init(global_gpios);
+	LOG_INF("LCD gpio bus, %d port writes per nibble", data_port_count);
+	return true;
+}
+
+const struct lcd_bus lcd_bus_gpio = {
+	.name = "gpio",
+	.init = lcd_bus_gpio_init,
+	.write_nibble = lcd_bus_gpio_write_nibble,
+	.set_rs = lcd_bus_gpio_set_rs,
+	.pulse_e = lcd_bus_gpio_pulse_e,
+	.delay = lcd_bus_wait,
+	.backlight = lcd_bus_gpio_backlight,
+};
+
+#endif /* CONFIG_APP_LCD_BUS_GPIO */
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(lcd_model, CONFIG_APP_LCD_LOG_LEVEL);
+
+#include "lcd_bus.h"
+
+#include <string.h>
+
+#ifdef CONFIG_APP_LCD_BUS_MODEL
+
+/* Software HD44780. It keeps DDRAM, CGRAM and the registers up to date
+ * from the bus cycles and checks every E pulse against the datasheet
+ * timing. Time is simulated: delay() only advances the model clock, so
+ * a redraw costs no real bus time. It replaces the lcd on the Nucleo
+ * boards, the rest of the application still needs their peripherals.
+ * tests/lcd_model links it with lcd.c alone and runs on native_posix.
+ */
+#define LCD_MODEL_COLS			16
+#define LCD_MODEL_ROWS			2
+#define LCD_MODEL_ROW_LEN		40	/* DDRAM per line */
+#define LCD_MODEL_CGRAM_SIZE		64
+
+/* datasheet execution times at fosc = 270 kHz, scaled to 190 kHz */
+#define LCD_MODEL_NS(ns)		((uint64_t)(ns) * 270U / 190U)
+#define LCD_MODEL_EXEC_NS		LCD_MODEL_NS(37000)
+#define LCD_MODEL_EXEC_DATA_NS		LCD_MODEL_NS(37000 + 4000)
+#define LCD_MODEL_EXEC_CLEAR_NS		LCD_MODEL_NS(1520000)
+/* waits of the reset sequence, datasheet figure 24 */
+#define LCD_MODEL_INIT_1ST_NS		4100000
+#define LCD_MODEL_INIT_2ND_NS		100000
+
+struct lcd_model {
+	uint8_t ddram[LCD_MODEL_ROWS][LCD_MODEL_ROW_LEN];
+	uint8_t cgram[LCD_MODEL_CGRAM_SIZE];
+	uint8_t ac;			/* address counter */
+	bool ac_cgram;			/* ac points into CGRAM */
+	bool increment;			/* entry mode I/D */
+	bool entry_shift;		/* entry mode S */
+	uint8_t display_cntl;
+	uint8_t shift;			/* display shift */
+	bool four_bit;
+	uint8_t resets;			/* 8 bit function sets seen */
+
+	/* bus lines */
+	uint8_t nibble;
+	bool rs;
+	/* first half of a byte in 4 bit mode */
+	bool have_high;
+	uint8_t high;
+	bool high_rs;
+
+	uint64_t now_ns;
+	uint64_t busy_until_ns;
+	bool backlight;
+
+	struct lcd_model_stats stats;
+};
+
+static struct lcd_model model;
+
+static void lcd_model_violation(const char *what, uint8_t bits)
+{
+	model.stats.violations++;
+	LOG_ERR("LCD model: %s (0x%02x, rs %d) at %u us", what, bits,
+		model.rs, (uint32_t)(model.now_ns / NSEC_PER_USEC));
+}
+
+static uint8_t *lcd_model_ddram_cell(uint8_t addr)
+{
+	uint8_t row = (addr & 0x40) ? 1 : 0;
+
+	return &model.ddram[row][(addr & 0x3F) % LCD_MODEL_ROW_LEN];
+}
+
+static void lcd_model_ac_step(void)
+{
+	uint8_t row_base;
+	uint8_t col;
+
+	if (model.ac_cgram) {
+		model.ac = (model.ac + (model.increment ? 1 : -1)) &
+			   (LCD_MODEL_CGRAM_SIZE - 1);
+		return;
+	}
+
+	/* DDRAM wraps from the end of a line to the start of the next */
+	row_base = model.ac & 0x40;
+	col = model.ac & 0x3F;
+	if (model.increment) {
+		if (++col >= LCD_MODEL_ROW_LEN) {
+			col = 0;
+			row_base ^= 0x40;
+		}
+	} else {
+		if (col-- == 0) {
+			col = LCD_MODEL_ROW_LEN - 1;
+			row_base ^= 0x40;
+		}
+	}
+	model.ac = row_base | col;
+}
+
+static void lcd_model_shift_display(bool right)
+{
+	model.shift = (model.shift + (right ? LCD_MODEL_ROW_LEN - 1 : 1)) %
+		      LCD_MODEL_ROW_LEN;
+}
+
+/** Execute a complete instruction, returns its execution time */
+static uint64_t lcd_model_instruction(uint8_t bits)
+{
+	model.stats.instructions++;
+
+	if (bits & 0x80) {
+		model.ac = bits & 0x7F;
+		model.ac_cgram = false;
+	} else if (bits & 0x40) {
+		model.ac = bits & 0x3F;
+		model.ac_cgram = true;
+	} else if (bits & 0x20) {
+		if (!model.four_bit && (bits & 0x10)) {
+			/* reset sequence of figure 24 */
+			model.resets++;
+			if (model.resets == 1) {
+				return LCD_MODEL_INIT_1ST_NS;
+			} else if (model.resets == 2) {
+				return LCD_MODEL_INIT_2ND_NS;
+			}
+		}
+		if (!(bits & 0x10)) {
+			if (!model.four_bit && (model.resets < 3)) {
+				lcd_model_violation("4 bit mode without reset sequence", bits);
+			}
+			model.four_bit = true;
+		}
+	} else if (bits & 0x10) {
+		if (bits & 0x08) {
+			lcd_model_shift_display(bits & 0x04);
+		} else {
+			bool saved = model.increment;
+
+			model.increment = bits & 0x04;
+			lcd_model_ac_step();
+			model.increment = saved;
+		}
+	} else if (bits & 0x08) {
+		model.display_cntl = bits & 0x07;
+	} else if (bits & 0x04) {
+		model.increment = bits & 0x02;
+		model.entry_shift = bits & 0x01;
+	} else if (bits & 0x02) {
+		model.ac = 0;
+		model.ac_cgram = false;
+		model.shift = 0;
+		return LCD_MODEL_EXEC_CLEAR_NS;
+	} else if (bits & 0x01) {
+		(void)memset(model.ddram, ' ', sizeof(model.ddram));
+		model.ac = 0;
+		model.ac_cgram = false;
+		model.shift = 0;
+		model.increment = true;
+		return LCD_MODEL_EXEC_CLEAR_NS;
+	}
+
+	return LCD_MODEL_EXEC_NS;
+}
+
+static uint64_t lcd_model_data(uint8_t bits)
+{
+	model.stats.data++;
+
+	if (model.ac_cgram) {
+		model.cgram[model.ac] = bits & 0x1F;
+	} else {
+		*lcd_model_ddram_cell(model.ac) = bits;
+		if (model.entry_shift) {
+			lcd_model_shift_display(!model.increment);
+		}
+	}
+	lcd_model_ac_step();
+
+	return LCD_MODEL_EXEC_DATA_NS;
+}
+
+static void lcd_model_byte(uint8_t bits, bool rs)
+{
+	if (model.now_ns < model.busy_until_ns) {
+		lcd_model_violation("write while busy", bits);
+	}
+
+	model.busy_until_ns = model.now_ns +
+		(rs ? lcd_model_data(bits) : lcd_model_instruction(bits));
+}
+
+static void lcd_model_pulse_e(void)
+{
+	model.stats.cycles++;
+
+	if (!model.four_bit) {
+		/* D0-D3 are not connected and read as 0 */
+		lcd_model_byte(model.nibble << 4, model.rs);
+	} else if (!model.have_high) {
+		model.high = model.nibble;
+		model.high_rs = model.rs;
+		model.have_high = true;
+		if (model.now_ns < model.busy_until_ns) {
+			lcd_model_violation("write while busy", model.nibble << 4);
+		}
+	} else {
+		model.have_high = false;
+		if (model.rs != model.high_rs) {
+			lcd_model_violation("RS changed within a byte", model.high << 4);
+		}
+		/* the busy check was done for the high nibble */
+		model.busy_until_ns = 0;
+		lcd_model_byte((model.high << 4) | model.nibble, model.high_rs);
+	}
+
+	model.now_ns += (LCD_ENABLE_PULSE_US + LCD_ENABLE_CYCLE_US) * NSEC_PER_USEC;
+	model.stats.bus_ns = model.now_ns;
+}
+
+static void lcd_model_write_nibble(uint8_t nibble)
+{
+	model.nibble = nibble & 0x0F;
+}
+
+static void lcd_model_set_rs(bool data)
+{
+	model.rs = data;
+}
+
+static void lcd_model_delay(uint32_t usec)
+{
+	model.now_ns += (uint64_t)usec * NSEC_PER_USEC;
+	model.stats.bus_ns = model.now_ns;
+}
+
+static void lcd_model_backlight(bool enable)
+{
+	model.backlight = enable;
+}
+
+static bool lcd_model_init(void)
+{
+	/* power on reset state */
+	(void)memset(&model, 0, sizeof(model));
+	(void)memset(model.ddram, ' ', sizeof(model.ddram));
+	model.increment = true;
+	return true;
+}
+
+void lcd_model_stats_get(struct lcd_model_stats *stats)
+{
+	*stats = model.stats;
+}
+
+void lcd_model_line(uint8_t row, char *buf)
+{
+	row = MIN(row, LCD_MODEL_ROWS - 1);
+
+	for (int col = 0; col < LCD_MODEL_COLS; col++) {
+		buf[col] = model.ddram[row][(col + model.shift) % LCD_MODEL_ROW_LEN];
+	}
+	buf[LCD_MODEL_COLS] = '\0';
+}
+
+const uint8_t *lcd_model_cgram(uint8_t slot)
+{
+	return &model.cgram[(slot & 0x07) * 8];
+}
+
+void lcd_model_dump(void)
+{
+	char line[LCD_MODEL_COLS + 1];
+
+	LOG_INF("LCD model: %u cycles, %u instructions, %u data, "
+		"%u violations, %u us bus time",
+		model.stats.cycles, model.stats.instructions, model.stats.data,
+		model.stats.violations,
+		(uint32_t)(model.stats.bus_ns / NSEC_PER_USEC));
+	for (uint8_t row = 0; row < LCD_MODEL_ROWS; row++) {
+		lcd_model_line(row, line);
+		for (int col = 0; col < LCD_MODEL_COLS; col++) {
+			/* CGRAM characters */
+			if ((uint8_t)line[col] < 0x10) {
+				line[col] = '*';
+			}
+		}
+		LOG_INF("  |%s|", log_strdup(line));
+	}
+	LOG_INF("  display %s, cursor %s, blink %s, backlight %s",
+		(model.display_cntl & 0x04) ? "on" : "off",
+		(model.display_cntl & 0x02) ? "on" : "off",
+		(model.display_cntl & 0x01) ? "on" : "off",
+		model.backlight ? "on" : "off");
+}
+
+const struct lcd_bus lcd_bus_model = {
+	.name = "model",
+	.init = lcd_model_init,
+	.write_nibble = lcd_model_write_nibble,
+	.set_rs = lcd_model_set_rs,
+	.pulse_e = lcd_model_pulse_e,
+	.delay = lcd_model_delay,
+	.backlight = lcd_model_backlight,
+};
+
+#endif /* CONFIG_APP_LCD_BUS_MODEL */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(lcd_pcf8574, CONFIG_APP_LCD_LOG_LEVEL);
+
+#include "lcd_bus.h"
+
+#include <drivers/i2c.h>
+
+#ifdef CONFIG_APP_LCD_BUS_PCF8574
+
+/* Port wiring of the common I2C lcd backpacks */
+#define PCF8574_RS			BIT(0)
+#define PCF8574_RW			BIT(1)	/* tied low, only writes */
+#define PCF8574_E			BIT(2)
+#define PCF8574_BL			BIT(3)
+#define PCF8574_DATA_SHIFT		4
+
+struct lcd_pcf8574 {
+	struct device *i2c;
+	/* port value, RS and D4-D7 only go out with the next E pulse */
+	uint8_t port;
+};
+
+static struct lcd_pcf8574 pcf8574;
+
+static void lcd_bus_pcf8574_write_nibble(uint8_t nibble)
+{
+	pcf8574.port = (pcf8574.port & 0x0F) | (nibble << PCF8574_DATA_SHIFT);
+}
+
+static void lcd_bus_pcf8574_set_rs(bool data)
+{
+	if (data) {
+		pcf8574.port |= PCF8574_RS;
+	} else {
+		pcf8574.port &= ~PCF8574_RS;
+	}
+}
+
+/* One i2c transfer: data and RS settle, E high, E low. Each byte takes
+ * 22 us at 400 kHz, that covers t_AS, PW_EH and t_H.
+ */
+static void lcd_bus_pcf8574_pulse_e(void)
+{
+	uint8_t buf[3] = {
+		pcf8574.port,
+		pcf8574.port | PCF8574_E,
+		pcf8574.port,
+	};
+
+	if (i2c_write(pcf8574.i2c, buf, sizeof(buf), CONFIG_APP_LCD_PCF8574_ADDR)) {
+		LOG_ERR("Failed to write to pcf8574");
+	}
+}
+
+static void lcd_bus_pcf8574_backlight(bool enable)
+{
+	if (enable) {
+		pcf8574.port |= PCF8574_BL;
+	} else {
+		pcf8574.port &= ~PCF8574_BL;
+	}
+
+	if (i2c_write(pcf8574.i2c, &pcf8574.port, 1, CONFIG_APP_LCD_PCF8574_ADDR)) {
+		LOG_ERR("Failed to write to pcf8574");
+	}
+}
+
+static bool lcd_bus_pcf8574_init(void)
+{
+	pcf8574.i2c = device_get_binding(CONFIG_APP_LCD_PCF8574_I2C_DEV);
+	if (!pcf8574.i2c) {
+		LOG_ERR("Cannot find %s!", CONFIG_APP_LCD_PCF8574_I2C_DEV);
+		return false;
+	}
+
+	/* all outputs low, this also checks that the backpack acks */
+	pcf8574.port = 0;
+	if (i2c_write(pcf8574.i2c, &pcf8574.port, 1, CONFIG_APP_LCD_PCF8574_ADDR)) {
+		LOG_ERR("No pcf8574 at 0x%02x", CONFIG_APP_LCD_PCF8574_ADDR);
+		return false;
+	}
+
+	return true;
+}
+
+const struct lcd_bus lcd_bus_pcf8574 = {
+	.name = "pcf8574",
+	.init = lcd_bus_pcf8574_init,
+	.write_nibble = lcd_bus_pcf8574_write_nibble,
+	.set_rs = lcd_bus_pcf8574_set_rs,
+	.pulse_e = lcd_bus_pcf8574_pulse_e,
+	.delay = lcd_bus_wait,
+	.backlight = lcd_bus_pcf8574_backlight,
+};
+
+#endif /* CONFIG_APP_LCD_BUS_PCF8574 */
@@ -4,9 +4,10 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include <zephyr.h>
+#include <logging/log.h>
+LOG_MODULE_REGISTER(main, CONFIG_APP_CTRL_LOG_LEVEL);
 
-#include <sys/printk.h>
+#include <zephyr.h>
 
 #include "controller.h"
 
@@ -15,11 +16,9 @@ void main(void)
 	void* controller = ctrl_init();
 	
 	if (!controller) {
-		printk("Failed to init ctrl\n");
+		LOG_ERR("Failed to init ctrl");
 		return;
 	}
 
-	while (1) {
-		k_msleep(10000);
-	}
+	/* the controller thread does the work, main may end */
 }
@@ -4,9 +4,11 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <logging/log.h>
+LOG_MODULE_REGISTER(output, CONFIG_APP_IO_LOG_LEVEL);
+
 #include "output.h"
 
-#include <sys/printk.h>
 #include <drivers/gpio.h>
 
 #if defined(CONFIG_BOARD_NUCLEO_F446RE)
@@ -43,11 +45,11 @@ static bool gpio_init(struct gpio_info* gpios, int length)
 	for (int i = 0; i < length; i++) {
 		gpios[i].dev = device_get_binding(gpios[i].port);
 		if (!gpios[i].dev) {
-			printk("Cannot find %s!\n", gpios[i].port);
+			LOG_ERR("Cannot find %s!", gpios[i].port);
 			return false;
 		}
 		if (gpio_pin_configure(gpios[i].dev, gpios[i].index, GPIO_OUTPUT)) {
-			printk("Failed to set %s_%d as output\n", gpios[i].port, gpios[i].index);
+			LOG_ERR("Failed to set %s_%d as output", gpios[i].port, gpios[i].index);
 			return false;
 		}
 	}
@@ -58,14 +60,14 @@ static inline void output_gpio_write(struct gpio_info* gpios, enum gpio_index id
 {
 	struct gpio_info *gi = &gpios[idx];
 	if (gpio_pin_set_raw(gi->dev, gi->index, value)) {
-		printk("Failed to set idx %d to %d\n", idx, value);
+		LOG_ERR("Failed to set idx %d to %d", idx, value);
 	}
 }
 
 void output_set(void *dev, enum output_type type)
 {
 	struct gpio_info* gpios = dev;
-	printk("Set output pins for %d\n", type);
+	LOG_DBG("Set output pins for %d", type);
 	
 	switch (type) {
 	case OUTPUT_DAY:
@@ -92,7 +94,7 @@ void *output_init(void)
 	ret = gpio_init(gpios, ARRAY_SIZE(global_gpios));
 	
 	if (!ret) {
-		printk("Failed to init output gpios\n");
+		LOG_ERR("Failed to init output gpios");
 		return NULL;
 	}
 
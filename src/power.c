@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(power, CONFIG_APP_IO_LOG_LEVEL);
+
+#include "power.h"
+
+#if defined(CONFIG_APP_PM_STOP) || defined(CONFIG_APP_CLOCK_PROFILES)
+#include <soc.h>
+#include <stm32f4xx_ll_pwr.h>
+#include <stm32f4xx_ll_rcc.h>
+#include <stm32f4xx_ll_system.h>
+
+struct power_clock {
+	uint32_t sysclk;	/* LL_RCC_SYS_CLKSOURCE_STATUS_* */
+	uint32_t latency;	/* LL_FLASH_LATENCY_* */
+	bool hse;
+	bool pll;
+	bool overdrive;
+};
+
+static void power_clock_save(struct power_clock *clk)
+{
+	clk->sysclk = LL_RCC_GetSysClkSource();
+	clk->latency = LL_FLASH_GetLatency();
+	clk->hse = LL_RCC_HSE_IsReady();
+	clk->pll = LL_RCC_PLL_IsReady();
+	clk->overdrive = LL_PWR_IsEnabledOverDriveMode();
+}
+
+/** Back to a saved clock, the PLL configuration is retained while it is off */
+static void power_clock_restore(const struct power_clock *clk)
+{
+	/* wait states before the frequency goes up */
+	if (clk->latency > LL_FLASH_GetLatency()) {
+		LL_FLASH_SetLatency(clk->latency);
+		while (LL_FLASH_GetLatency() != clk->latency) {
+		}
+	}
+	if (clk->hse) {
+		LL_RCC_HSE_Enable();
+		while (!LL_RCC_HSE_IsReady()) {
+		}
+	}
+	if (clk->pll) {
+		LL_RCC_PLL_Enable();
+		while (!LL_RCC_PLL_IsReady()) {
+		}
+	}
+	if (clk->overdrive) {
+		LL_PWR_EnableOverDriveMode();
+		while (!LL_PWR_IsActiveFlag_OD()) {
+		}
+		LL_PWR_EnableOverDriveSwitching();
+		while (!LL_PWR_IsActiveFlag_ODSW()) {
+		}
+	}
+
+	switch (clk->sysclk) {
+	case LL_RCC_SYS_CLKSOURCE_STATUS_PLL:
+		LL_RCC_SetSysClkSource(LL_RCC_SYS_CLKSOURCE_PLL);
+		break;
+	case LL_RCC_SYS_CLKSOURCE_STATUS_HSE:
+		LL_RCC_SetSysClkSource(LL_RCC_SYS_CLKSOURCE_HSE);
+		break;
+	default:
+		return;
+	}
+	while (LL_RCC_GetSysClkSource() != clk->sysclk) {
+	}
+}
+#endif
+
+#ifdef CONFIG_APP_PM_STOP
+#include <stm32f4xx_ll_cortex.h>
+#include <stm32f4xx_ll_rtc.h>
+
+/* STOP mode with the low power regulator and the flash powered down. All
+ * clocks but LSE/LSI stop, so do SysTick and the kernel time. The policy
+ * only enters it when no kernel timeout is pending; then only the RTC
+ * alarm and wakeup timer (also scanning the keypad) wake the cpu. The kernel
+ * time stands still in STOP, so both run and STOP residency are measured
+ * with the RTC time of day. An interval over a day or across setting the
+ * clock is counted wrong.
+ */
+#define POWER_MSEC_PER_DAY	(24U * 60U * 60U * MSEC_PER_SEC)
+
+struct power_stats {
+	bool started;
+	uint32_t stops;
+	uint32_t run_msec;
+	uint32_t stop_msec;
+	uint32_t stop_begin;
+	uint32_t wake;		/* end of the last STOP */
+};
+
+static struct power_clock power_clock;
+static struct power_stats power_stats;
+
+/** RTC time of day in ms, read SSR, TR, DR in this order to unlock the shadow */
+static uint32_t power_rtc_msec(void)
+{
+	uint32_t prediv = LL_RTC_GetSynchPrescaler(RTC);
+	uint32_t ssr = LL_RTC_TIME_GetSubSecond(RTC);
+	uint32_t time = LL_RTC_TIME_Get(RTC);
+	uint32_t secs;
+
+	(void)LL_RTC_DATE_Get(RTC);
+	secs = (__LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_HOUR(time)) * 60U +
+		__LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_MINUTE(time))) * 60U +
+	       __LL_RTC_CONVERT_BCD2BIN(__LL_RTC_GET_SECOND(time));
+
+	return secs * MSEC_PER_SEC + (prediv - ssr) * MSEC_PER_SEC / (prediv + 1);
+}
+
+static uint32_t power_rtc_since(uint32_t begin, uint32_t end)
+{
+	return (end + POWER_MSEC_PER_DAY - begin) % POWER_MSEC_PER_DAY;
+}
+
+/** Until the first STOP the kernel time is right */
+static void power_stats_start(uint32_t now)
+{
+	if (!power_stats.started) {
+		power_stats.started = true;
+		power_stats.run_msec = k_uptime_get_32();
+		power_stats.wake = now;
+	}
+}
+
+/** The shadow registers are stale after STOP until the next sync */
+static void power_rtc_sync(void)
+{
+	LL_RTC_DisableWriteProtection(RTC);
+	LL_RTC_ClearFlag_RS(RTC);
+	while (!LL_RTC_IsActiveFlag_RS(RTC)) {
+	}
+	LL_RTC_EnableWriteProtection(RTC);
+}
+
+enum power_states sys_pm_policy_next_state(int32_t ticks)
+{
+	/* a pending timeout would be missed with SysTick stopped */
+	if ((ticks == K_TICKS_FOREVER) &&
+	    sys_pm_ctrl_is_state_enabled(SYS_POWER_STATE_SLEEP_1)) {
+		return SYS_POWER_STATE_SLEEP_1;
+	}
+	return SYS_POWER_STATE_ACTIVE;
+}
+
+/* Called by the idle thread with interrupts locked */
+void sys_set_power_state(enum power_states state)
+{
+	if (state != SYS_POWER_STATE_SLEEP_1) {
+		return;
+	}
+
+	power_clock_save(&power_clock);
+	power_stats.stop_begin = power_rtc_msec();
+	power_stats_start(power_stats.stop_begin);
+	power_stats.run_msec += power_rtc_since(power_stats.wake, power_stats.stop_begin);
+
+	LL_PWR_ClearFlag_WU();
+	LL_PWR_SetPowerMode(LL_PWR_MODE_STOP_LPREGU);
+	LL_PWR_EnableFlashPowerDown();
+	LL_LPM_EnableDeepSleep();
+
+	/* like arch_cpu_idle(): an interrupt masked by BASEPRI does not end
+	 * WFI, PRIMASK does not keep it from waking the cpu. The interrupt
+	 * runs when the exit post ops restored the clocks and unlock.
+	 */
+	__disable_irq();
+	__set_BASEPRI(0);
+	__ISB();
+	__WFI();
+}
+
+void _sys_pm_power_state_exit_post_ops(enum power_states state)
+{
+	if (state == SYS_POWER_STATE_SLEEP_1) {
+		LL_LPM_EnableSleep();
+		/* STOP wakes up on HSI */
+		power_clock_restore(&power_clock);
+		power_rtc_sync();
+
+		power_stats.stops++;
+		power_stats.wake = power_rtc_msec();
+		power_stats.stop_msec += power_rtc_since(power_stats.stop_begin,
+							 power_stats.wake);
+	}
+
+	/* PRIMASK from sys_set_power_state(), BASEPRI locked by the idle
+	 * thread before sys_suspend()
+	 */
+	__enable_irq();
+	irq_unlock(0);
+}
+
+void power_stats_dump(void)
+{
+	unsigned int key = irq_lock();
+	uint32_t now = power_rtc_msec();
+	uint32_t run;
+	uint32_t stop;
+	uint32_t total;
+
+	power_stats_start(now);
+	run = power_stats.run_msec + power_rtc_since(power_stats.wake, now);
+	stop = power_stats.stop_msec;
+	irq_unlock(key);
+	total = run + stop;
+
+	LOG_INF("Power: %u s run, %u s stop (%u%%), %u wake-ups from stop",
+		run / MSEC_PER_SEC, stop / MSEC_PER_SEC,
+		total ? (uint32_t)((uint64_t)stop * 100U / total) : 0,
+		power_stats.stops);
+}
+
+#endif /* CONFIG_APP_PM_STOP */
+
+#ifdef CONFIG_APP_CLOCK_PROFILES
+#include <drivers/timer/system_timer.h>
+#include <stm32f4xx_ll_usart.h>
+
+/* The low profile runs SYSCLK from the 16 MHz HSI with PLL, HSE and the
+ * over-drive off and no flash wait states. The boost profile is the PLL
+ * setup of the board, saved when it is left. The AHB/APB prescalers stay,
+ * so clock_control_get_rate() is right with SystemCoreClock updated.
+ *
+ * SysTick runs on HCLK. The kernel reads its rate at run time, the timer
+ * driver is reprogrammed around the switch so at most one tick is
+ * counted at the wrong rate.
+ */
+#if defined(CONFIG_BOARD_NUCLEO_F446RE)
+#define POWER_CONSOLE_UART	USART2	/* on APB1 */
+#define POWER_CONSOLE_PCLK	PCLK1_Frequency
+#endif
+
+#define POWER_CONSOLE_BAUD	DT_PROP(DT_CHOSEN(zephyr_console), current_speed)
+
+struct power_profile_stats {
+	uint32_t switches;
+	uint32_t since;
+	uint32_t msec[POWER_PROFILES];
+};
+
+static struct power_clock power_boost_clock;
+static enum power_profile power_profile_current = POWER_PROFILE_BOOST;
+static struct power_profile_stats power_profile_stats;
+static sys_slist_t power_listeners;
+
+static void power_clock_hsi(void)
+{
+	LL_RCC_HSI_Enable();
+	while (!LL_RCC_HSI_IsReady()) {
+	}
+	LL_RCC_SetSysClkSource(LL_RCC_SYS_CLKSOURCE_HSI);
+	while (LL_RCC_GetSysClkSource() != LL_RCC_SYS_CLKSOURCE_STATUS_HSI) {
+	}
+
+	LL_PWR_DisableOverDriveSwitching();
+	LL_PWR_DisableOverDriveMode();
+	LL_RCC_PLL_Disable();
+	LL_RCC_HSE_Disable();
+
+	/* wait states after the frequency went down */
+	LL_FLASH_SetLatency(LL_FLASH_LATENCY_0);
+	while (LL_FLASH_GetLatency() != LL_FLASH_LATENCY_0) {
+	}
+}
+
+#ifdef POWER_CONSOLE_UART
+static void power_console_changed(void)
+{
+	LL_RCC_ClocksTypeDef clocks;
+
+	LL_RCC_GetSystemClocksFreq(&clocks);
+	LL_USART_SetBaudRate(POWER_CONSOLE_UART, clocks.POWER_CONSOLE_PCLK,
+			     LL_USART_OVERSAMPLING_16, POWER_CONSOLE_BAUD);
+}
+#endif
+
+void power_clock_listen(struct power_clock_listener *listener)
+{
+	unsigned int key = irq_lock();
+
+	sys_slist_append(&power_listeners, &listener->node);
+	irq_unlock(key);
+}
+
+void power_profile_set(enum power_profile profile)
+{
+	struct power_clock_listener *listener;
+	uint32_t now = k_uptime_get_32();
+	unsigned int key;
+
+	if (profile == power_profile_current) {
+		return;
+	}
+
+	key = irq_lock();
+
+#ifdef POWER_CONSOLE_UART
+	/* let the byte on the wire finish at the old baud rate */
+	while (!LL_USART_IsActiveFlag_TC(POWER_CONSOLE_UART)) {
+	}
+#endif
+	/* account the cycles since the last announcement at the old rate */
+	z_clock_set_timeout(1, false);
+
+	if (profile == POWER_PROFILE_LOW) {
+		power_clock_save(&power_boost_clock);
+		power_clock_hsi();
+	} else {
+		power_clock_restore(&power_boost_clock);
+	}
+
+	SystemCoreClockUpdate();
+	z_clock_hw_cycles_per_sec = SystemCoreClock;
+	/* the next tick with the new cycles per tick */
+	z_clock_set_timeout(1, false);
+
+#ifdef POWER_CONSOLE_UART
+	power_console_changed();
+#endif
+	SYS_SLIST_FOR_EACH_CONTAINER(&power_listeners, listener, node) {
+		listener->changed();
+	}
+
+	irq_unlock(key);
+
+	power_profile_stats.msec[power_profile_current] += now - power_profile_stats.since;
+	power_profile_stats.since = now;
+	power_profile_stats.switches++;
+	power_profile_current = profile;
+
+	LOG_DBG("SYSCLK %u Hz", SystemCoreClock);
+}
+
+uint32_t power_profile_switches(void)
+{
+	return power_profile_stats.switches;
+}
+
+void power_profile_stats_dump(void)
+{
+	uint32_t now = k_uptime_get_32();
+	uint32_t msec[POWER_PROFILES];
+
+	for (int i = 0; i < POWER_PROFILES; i++) {
+		msec[i] = power_profile_stats.msec[i];
+	}
+	msec[power_profile_current] += now - power_profile_stats.since;
+
+	LOG_INF("Clock: %u s low, %u s boost, %u switches, now %u Hz",
+		msec[POWER_PROFILE_LOW] / MSEC_PER_SEC,
+		msec[POWER_PROFILE_BOOST] / MSEC_PER_SEC,
+		power_profile_stats.switches, SystemCoreClock);
+}
+#endif /* CONFIG_APP_CLOCK_PROFILES */
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_POWER_H
+#define APP_POWER_H
+
+#include <zephyr.h>
+#include <sys/slist.h>
+
+#ifdef CONFIG_APP_PM_STOP
+#include <power/power.h>
+
+/** Keep the cpu out of STOP mode, nests. Callable from interrupts. */
+static inline void power_stop_lock(void)
+{
+	sys_pm_ctrl_disable_state(SYS_POWER_STATE_SLEEP_1);
+}
+
+static inline void power_stop_unlock(void)
+{
+	sys_pm_ctrl_enable_state(SYS_POWER_STATE_SLEEP_1);
+}
+
+/** Time in run and STOP mode and the number of wake-ups */
+void power_stats_dump(void);
+#else
+static inline void power_stop_lock(void)
+{
+}
+
+static inline void power_stop_unlock(void)
+{
+}
+
+static inline void power_stats_dump(void)
+{
+}
+#endif
+
+enum power_profile {
+	POWER_PROFILE_LOW = 0,	/* SYSCLK from HSI */
+	POWER_PROFILE_BOOST,	/* the PLL as configured at boot */
+	POWER_PROFILES,
+};
+
+/** Peripheral timing that follows the bus clocks
+ *
+ * changed() is called with interrupts locked right after a profile
+ * switch, clock_control_get_rate() already returns the new rates.
+ */
+struct power_clock_listener {
+	sys_snode_t node;
+	void (*changed)(void);
+};
+
+#ifdef CONFIG_APP_CLOCK_PROFILES
+void power_clock_listen(struct power_clock_listener *listener);
+
+/** Switch SYSCLK, a no-op if the profile is active. Thread context only. */
+void power_profile_set(enum power_profile profile);
+
+/** Number of profile switches, the cycle counter rate changes with each */
+uint32_t power_profile_switches(void);
+
+/** Time spent in each profile */
+void power_profile_stats_dump(void);
+#else
+static inline void power_clock_listen(struct power_clock_listener *listener)
+{
+}
+
+static inline void power_profile_set(enum power_profile profile)
+{
+}
+
+static inline uint32_t power_profile_switches(void)
+{
+	return 0;
+}
+
+static inline void power_profile_stats_dump(void)
+{
+}
+#endif
+
+#endif /* APP_POWER_H */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+LOG_MODULE_REGISTER(schedule, CONFIG_APP_CTRL_LOG_LEVEL);
+
+#include "schedule.h"
+#include "clock.h"
+
+#include <string.h>
+
+#define SCHEDULE_SLOTS		(SCHEDULE_DAYS * SCHEDULE_SLOTS_PER_DAY)
+#define SCHEDULE_SLOT_BITS	2
+#define SCHEDULE_SLOT_MASK	0x03
+#define SCHEDULE_SLOTS_PER_BYTE	(8 / SCHEDULE_SLOT_BITS)
+/* a byte with all four slots in mode 1 */
+#define SCHEDULE_BYTE_ONES	0x55
+
+#define SCHEDULE_MAGIC		0xAA55500D
+
+/* stored in the backup sram */
+struct schedule_store {
+	uint32_t magic;
+	struct schedule schedule;
+} __attribute__((packed));
+
+struct schedule_ctx {
+	struct schedule schedule;
+	/* the week in quarter hours, 168 bytes */
+	uint8_t map[SCHEDULE_SLOTS / SCHEDULE_SLOTS_PER_BYTE];
+};
+
+static struct schedule_ctx schedule_ctx;
+
+static inline uint8_t schedule_slot_get(const uint8_t *map, uint16_t slot)
+{
+	return (map[slot / SCHEDULE_SLOTS_PER_BYTE] >>
+		((slot % SCHEDULE_SLOTS_PER_BYTE) * SCHEDULE_SLOT_BITS)) &
+	       SCHEDULE_SLOT_MASK;
+}
+
+static inline void schedule_slot_set(uint8_t *map, uint16_t slot, uint8_t mode)
+{
+	uint8_t shift = (slot % SCHEDULE_SLOTS_PER_BYTE) * SCHEDULE_SLOT_BITS;
+	uint8_t *byte = &map[slot / SCHEDULE_SLOTS_PER_BYTE];
+
+	*byte = (*byte & ~(SCHEDULE_SLOT_MASK << shift)) | (mode << shift);
+}
+
+static uint16_t schedule_slot(const struct tm *now)
+{
+	return now->tm_wday * SCHEDULE_SLOTS_PER_DAY +
+	       (now->tm_hour * 60 + now->tm_min) / SCHEDULE_SLOT_MIN;
+}
+
+static void schedule_compile(struct schedule_ctx *ctx)
+{
+	/* SCHEDULE_NIGHT is 0 */
+	(void)memset(ctx->map, 0, sizeof(ctx->map));
+
+	for (int day = 0; day < SCHEDULE_DAYS; day++) {
+		uint16_t base = day * SCHEDULE_SLOTS_PER_DAY;
+
+		for (int i = 0; i < SCHEDULE_INTERVALS; i++) {
+			const struct schedule_interval *iv = &ctx->schedule.days[day][i];
+			uint8_t end = MIN(iv->end, SCHEDULE_SLOTS_PER_DAY);
+
+			if (iv->mode >= SCHEDULE_MODES) {
+				continue;
+			}
+			for (uint16_t slot = iv->begin; slot < end; slot++) {
+				schedule_slot_set(ctx->map, base + slot, iv->mode);
+			}
+		}
+	}
+}
+
+static void schedule_default(struct schedule *schedule)
+{
+	(void)memset(schedule, 0, sizeof(*schedule));
+
+	for (int day = 0; day < SCHEDULE_DAYS; day++) {
+		schedule->days[day][0].begin = 6 * 60 / SCHEDULE_SLOT_MIN;
+		schedule->days[day][0].end = 22 * 60 / SCHEDULE_SLOT_MIN;
+		schedule->days[day][0].mode = SCHEDULE_DAY;
+	}
+}
+
+void *schedule_init(void)
+{
+	struct schedule_ctx *ctx = &schedule_ctx;
+	struct schedule_store store;
+
+	if (clock_sram_read(CLOCK_SRAM_SCHEDULE, &store, sizeof(store)) &&
+	    (store.magic == SCHEDULE_MAGIC)) {
+		ctx->schedule = store.schedule;
+	} else {
+		LOG_WRN("No schedule in backup sram, using the default");
+		schedule_default(&ctx->schedule);
+	}
+
+	schedule_compile(ctx);
+	return ctx;
+}
+
+struct schedule *schedule_get(void *dev)
+{
+	struct schedule_ctx *ctx = dev;
+
+	return &ctx->schedule;
+}
+
+void schedule_commit(void *dev)
+{
+	struct schedule_ctx *ctx = dev;
+	struct schedule_store store = {
+		.magic = SCHEDULE_MAGIC,
+		.schedule = ctx->schedule,
+	};
+
+	schedule_compile(ctx);
+	if (!clock_sram_write(CLOCK_SRAM_SCHEDULE, &store, sizeof(store))) {
+		LOG_ERR("Failed to store the schedule");
+	}
+}
+
+enum schedule_mode schedule_mode(void *dev, const struct tm *now)
+{
+	struct schedule_ctx *ctx = dev;
+
+	return schedule_slot_get(ctx->map, schedule_slot(now));
+}
+
+uint32_t schedule_next_change(void *dev, const struct tm *now)
+{
+	struct schedule_ctx *ctx = dev;
+	uint16_t start = schedule_slot(now);
+	uint8_t mode = schedule_slot_get(ctx->map, start);
+	/* four slots that stay in the mode */
+	uint8_t same = mode * SCHEDULE_BYTE_ONES;
+	uint32_t into_slot = (now->tm_min % SCHEDULE_SLOT_MIN) * 60 + now->tm_sec;
+	uint16_t n;
+
+	for (n = 1; n < SCHEDULE_SLOTS; n++) {
+		uint16_t slot = (start + n) % SCHEDULE_SLOTS;
+
+		/* skip whole bytes without a change */
+		if (((slot % SCHEDULE_SLOTS_PER_BYTE) == 0) &&
+		    ((n + SCHEDULE_SLOTS_PER_BYTE) <= SCHEDULE_SLOTS) &&
+		    (ctx->map[slot / SCHEDULE_SLOTS_PER_BYTE] == same)) {
+			n += SCHEDULE_SLOTS_PER_BYTE - 1;
+			continue;
+		}
+		if (schedule_slot_get(ctx->map, slot) != mode) {
+			break;
+		}
+	}
+
+	return n * SCHEDULE_SLOT_MIN * 60 - into_slot;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef APP_SCHEDULE_H
+#define APP_SCHEDULE_H
+
+#include <zephyr.h>
+#include <time.h>
+
+#define SCHEDULE_DAYS			7	/* indexed by tm_wday */
+#define SCHEDULE_INTERVALS		3	/* per weekday */
+#define SCHEDULE_SLOT_MIN		15
+#define SCHEDULE_SLOTS_PER_DAY		(24 * 60 / SCHEDULE_SLOT_MIN)
+
+/* 2 bit value of a slot */
+enum schedule_mode {
+	SCHEDULE_NIGHT = 0,	/* outside of all intervals */
+	SCHEDULE_DAY,
+	SCHEDULE_FROST,
+	SCHEDULE_MODES,
+};
+
+/** Mode from slot begin up to slot end, begin == end is unused
+ *
+ * end may be SCHEDULE_SLOTS_PER_DAY for midnight. Later intervals of a
+ * day take precedence.
+ */
+struct schedule_interval {
+	uint8_t begin;
+	uint8_t end;
+	uint8_t mode;
+} __attribute__((packed));
+
+struct schedule {
+	struct schedule_interval days[SCHEDULE_DAYS][SCHEDULE_INTERVALS];
+} __attribute__((packed));
+
+/** Load the schedule from backup sram, or the default of day 06:00-22:00 */
+void *schedule_init(void);
+
+/** The intervals, call schedule_commit() after changing them */
+struct schedule *schedule_get(void *dev);
+
+/** Compile the intervals into the slot map and store them */
+void schedule_commit(void *dev);
+
+/** Mode at the given time */
+enum schedule_mode schedule_mode(void *dev, const struct tm *now);
+
+/** Seconds until the mode changes, at least 1, at most a week */
+uint32_t schedule_next_change(void *dev, const struct tm *now);
+
+#endif /* APP_SCHEDULE_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2020 Christian Taedcke
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include <string.h>
+
+#include "lcd.h"
+#include "lcd_bus.h"
+
+/* Redraws of lcd.c against the HD44780 model: DDRAM and CGRAM contents,
+ * the number of E pulses and the timing violations of known screens.
+ */
+
+#define LINE_MAIN_0	"Mo 12:34:56 Tag "
+#define LINE_MAIN_1	"Tag  06:00-22:00"
+
+/* bytes of the main screen over a cleared display: the blanks are
+ * skipped, so 27 characters and 4 DDRAM addresses
+ */
+#define MAIN_DATA	27
+#define MAIN_COMMANDS	4
+
+static void *lcd;
+static struct lcd_model_stats before;
+
+static void lcd_setup(void)
+{
+	lcd = lcd_init();
+	zassert_not_null(lcd, "lcd_init() failed");
+	lcd_model_stats_get(&before);
+}
+
+static void assert_line(uint8_t row, const char *expected)
+{
+	char line[17];
+
+	lcd_model_line(row, line);
+	zassert_mem_equal(line, expected, 16, "row %u is |%s|", row, line);
+}
+
+/** Statistics since lcd_setup() or the last call */
+static void stats_delta(struct lcd_model_stats *delta)
+{
+	struct lcd_model_stats now;
+
+	lcd_model_stats_get(&now);
+	delta->cycles = now.cycles - before.cycles;
+	delta->instructions = now.instructions - before.instructions;
+	delta->data = now.data - before.data;
+	delta->violations = now.violations - before.violations;
+	delta->bus_ns = now.bus_ns - before.bus_ns;
+	before = now;
+}
+
+static void draw_main(void)
+{
+	lcd_clear(lcd);
+	lcd_set_cursor(lcd, 0, 0);
+	lcd_string(lcd, LINE_MAIN_0);
+	lcd_set_cursor(lcd, 0, 1);
+	lcd_string(lcd, LINE_MAIN_1);
+	lcd_flush(lcd);
+}
+
+static void test_init(void)
+{
+	struct lcd_model_stats stats;
+
+	lcd_model_stats_get(&stats);
+	zassert_equal(stats.violations, 0, "init sequence violates the timing");
+	assert_line(0, "                ");
+	assert_line(1, "                ");
+}
+
+static void test_redraw_main(void)
+{
+	struct lcd_model_stats delta;
+
+	draw_main();
+	stats_delta(&delta);
+
+	assert_line(0, LINE_MAIN_0);
+	assert_line(1, LINE_MAIN_1);
+	zassert_equal(delta.violations, 0, NULL);
+	zassert_equal(delta.data, MAIN_DATA, NULL);
+	zassert_equal(delta.instructions, MAIN_COMMANDS, NULL);
+	zassert_equal(delta.cycles, 2 * (MAIN_DATA + MAIN_COMMANDS), NULL);
+	zassert_equal(delta.bus_ns / NSEC_PER_USEC,
+		      delta.cycles * (LCD_ENABLE_PULSE_US + LCD_ENABLE_CYCLE_US) +
+		      MAIN_DATA * LCD_EXEC_DATA_US + MAIN_COMMANDS * LCD_EXEC_US,
+		      NULL);
+
+	TC_PRINT("main screen: %u E pulses, %u us model bus time\n",
+		 delta.cycles, (uint32_t)(delta.bus_ns / NSEC_PER_USEC));
+}
+
+static void test_redraw_changed_cell(void)
+{
+	struct lcd_model_stats delta;
+
+	draw_main();
+	stats_delta(&delta);
+
+	/* unchanged framebuffer, nothing on the bus */
+	lcd_flush(lcd);
+	stats_delta(&delta);
+	zassert_equal(delta.cycles, 0, NULL);
+
+	/* the seconds tick: one address and one character */
+	lcd_set_cursor(lcd, 10, 0);
+	lcd_string(lcd, "7");
+	lcd_flush(lcd);
+	stats_delta(&delta);
+
+	assert_line(0, "Mo 12:34:57 Tag ");
+	assert_line(1, LINE_MAIN_1);
+	zassert_equal(delta.instructions, 1, NULL);
+	zassert_equal(delta.data, 1, NULL);
+	zassert_equal(delta.cycles, 4, NULL);
+	zassert_equal(delta.violations, 0, NULL);
+}
+
+static void test_glyph_upload(void)
+{
+	static const uint8_t sun[8] = {
+		0x00, 0x15, 0x0E, 0x1B, 0x0E, 0x15, 0x00, 0x00,
+	};
+	struct lcd_model_stats delta;
+	struct lcd_stats stats;
+	uint32_t uploads;
+	char line[17];
+
+	lcd_stats_get(lcd, &stats);
+	uploads = stats.glyph_uploads;
+
+	lcd_set_cursor(lcd, 15, 0);
+	lcd_string(lcd, LCD_GLYPH_STR_SUN);
+	lcd_flush(lcd);
+	stats_delta(&delta);
+
+	/* CGRAM address and 8 rows, DDRAM address and the character */
+	lcd_stats_get(lcd, &stats);
+	zassert_equal(stats.glyph_uploads, uploads + 1, NULL);
+	zassert_equal(delta.instructions, 2, NULL);
+	zassert_equal(delta.data, 9, NULL);
+	zassert_equal(delta.violations, 0, NULL);
+	zassert_mem_equal(lcd_model_cgram(0), sun, sizeof(sun), NULL);
+	lcd_model_line(0, line);
+	zassert_equal(line[15], 0, "sun is not in CGRAM slot 0");
+
+	/* resident, the second use costs no upload */
+	lcd_set_cursor(lcd, 0, 1);
+	lcd_string(lcd, LCD_GLYPH_STR_SUN);
+	lcd_flush(lcd);
+	stats_delta(&delta);
+
+	lcd_stats_get(lcd, &stats);
+	zassert_equal(stats.glyph_uploads, uploads + 1, NULL);
+	zassert_equal(delta.data, 1, NULL);
+	lcd_model_line(1, line);
+	zassert_equal(line[0], 0, NULL);
+}
+
+static void test_utf8(void)
+{
+	char line[17];
+
+	lcd_set_cursor(lcd, 0, 0);
+	lcd_string(lcd, "\xc3\xa4\xc2\xb0");	/* "ä°" */
+	lcd_flush(lcd);
+
+	lcd_model_line(0, line);
+	zassert_equal((uint8_t)line[0], 0xE1, NULL);
+	zassert_equal((uint8_t)line[1], 0xDF, NULL);
+}
+
+static void test_violation(void)
+{
+	struct lcd_model_stats delta;
+
+	/* two characters without the execution time in between */
+	lcd_bus_model.set_rs(true);
+	for (int i = 0; i < 2; i++) {
+		lcd_bus_model.write_nibble('A' >> 4);
+		lcd_bus_model.pulse_e();
+		lcd_bus_model.write_nibble('A' & 0x0F);
+		lcd_bus_model.pulse_e();
+	}
+	stats_delta(&delta);
+
+	zassert_equal(delta.violations, 1, "write while busy not detected");
+}
+
+void test_main(void)
+{
+	ztest_test_suite(lcd_model,
+			 ztest_unit_test_setup_teardown(test_init,
+				lcd_setup, unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_redraw_main,
+				lcd_setup, unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_redraw_changed_cell,
+				lcd_setup, unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_glyph_upload,
+				lcd_setup, unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_utf8,
+				lcd_setup, unit_test_noop),
+			 ztest_unit_test_setup_teardown(test_violation,
+				lcd_setup, unit_test_noop));
+	ztest_run_test_suite(lcd_model);
+}